@@ -62,7 +62,7 @@ const char *bi_to_str(int bi)
 }
 
 
-int str_to_bi(char *s)
+int str_to_bi(const char *s)
 {
 	if(!strcmp(s, "GSM850") || !strcmp(s, "GSM-850") || !strcmp(s, "850"))
 		return GSM_850;
@@ -89,6 +89,49 @@ int str_to_bi(char *s)
 }
 
 
+/*
+ * A comma separated list of bands, e.g., "GSM900,DCS", or "all".  Bands
+ * listed twice count once.  Returns the number of bands, or -1.
+ */
+int str_to_bands(const char *s, int *bands, unsigned int max)
+{
+	static const int all[] = {GSM_850, GSM_R_900, GSM_E_900, DCS_1800, PCS_1900};
+	char name[32];
+	const char *e;
+	unsigned int n = 0, i, len;
+	int bi;
+
+	if(!strcmp(s, "all"))
+	{
+		for(i = 0; (i < sizeof(all) / sizeof(*all)) && (n < max); i++)
+			bands[n++] = all[i];
+		return n;
+	}
+
+	for(; *s; s = *e? e + 1 : e)
+	{
+		if(!(e = strchr(s, ',')))
+			e = s + strlen(s);
+		len = e - s;
+		if(len >= sizeof(name))
+			return -1;
+		memcpy(name, s, len);
+		name[len] = 0;
+		if((bi = str_to_bi(name)) == -1)
+			return -1;
+
+		for(i = 0; (i < n) && (bands[i] != bi); i++)
+			;
+		if(i < n)
+			continue;
+		if(n == max)
+			return -1;
+		bands[n++] = bi;
+	}
+	return n? (int)n : -1;
+}
+
+
 double arfcn_to_freq(int n, int *bi)
 {
 	if((128 <= n) && (n <= 251))
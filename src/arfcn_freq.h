@@ -35,8 +35,11 @@ enum {
 	PCS_1900
 };
 
+#define BI_MAX	6	// bands in a list
+
 const char *bi_to_str(int bi);
-int str_to_bi(char *s);
+int str_to_bi(const char *s);
+int str_to_bands(const char *s, int *bands, unsigned int max);
 double arfcn_to_freq(int n, int *bi = 0);
 int freq_to_arfcn(double freq, int *bi = 0);
 int first_chan(int bi);
@@ -29,132 +29,449 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
+#include <fftw3.h>
 
 #include "usrp_source.h"
 #include "circular_buffer.h"
 #include "fcch_detector.h"
 #include "arfcn_freq.h"
+#include "c0_detect.h"
 #include "util.h"
-
-extern int g_verbosity;
+#include "profile.h"
 
 static const float ERROR_DETECT_OFFSET_MAX = 40e3;
 
+/*
+ * A channel is captured C0_STEP_FRAMES TDMA frames at a time and each step is
+ * scanned as it arrives, together with the last frame of the step before so
+ * that a burst on the boundary is seen whole.  The capture ends at the first
+ * burst; only channels without one wait for all 12 frames.
+ */
+static const unsigned int	C0_STEP_FRAMES	= 3;
+
+/*
+ * The power pre-scan looks at PRESCAN_SPAN of spectrum per tune, i.e., 5
+ * channels, with PRESCAN_AVG FFTs of the undecimated stream, about two TDMA
+ * frames.  A beacon carrier transmits in every timeslot, so that is enough
+ * to see it.  The span keeps the outer channels, ±0.49 MHz with their width,
+ * off the skirts of the 1.4 MHz tuner filter, where they would look quieter
+ * than they are.
+ */
+static const unsigned int	PRESCAN_FFT	= 1024;
+static const unsigned int	PRESCAN_AVG	= 16;
+static const double		PRESCAN_SPAN	= 0.8e6;
+static const int		PRESCAN_BW	= 1400000;	// tuner bandwidth
+static const double		PRESCAN_CHAN_BW	= 180e3;
+
+/*
+ * The noise floor of a channel is the lower of two estimates: a low quantile
+ * of the power of all channels of its band, which holds while most of the
+ * band is empty, and the same quantile of the bins its tune saw, scaled to a
+ * channel, which holds while there are gaps between the carriers of the tune.
+ * Only a band that is nearly full and a tune without a gap together put the
+ * floor on the carriers.  Channels less than PRESCAN_SNR dB above the floor
+ * are skipped.
+ */
+static const unsigned int	PRESCAN_FLOOR	= 10;		// 1 / quantile
+static const float		PRESCAN_SNR	= 3.0;
+
+extern int g_prescan;
+
+// a channel to look at, with the band it was asked for in
+struct c0_chan
+{
+	int	chan,
+		bi;
+	double	freq;
+};
+
 #ifdef _WIN32
 #define BUFSIZ 1024
 #endif
 
-static double vectornorm2(const complex *v, const unsigned int len)
+// fresh samples, without overruns
+static int capture(usrp_source *u, unsigned int len)
 {
-	unsigned int i;
-	double e = 0.0;
+	unsigned int overruns;
 
-	for(i = 0; i < len; i++)
-		e += norm(v[i]);
-
-	return e;
+	do
+	{
+		u->flush();
+		if(u->fill(len, &overruns))
+			return -1;
+	} while(overruns);
+	return 0;
 }
 
 
-int c0_detect(usrp_source *u, int bi)
+/*
+ * Look for an FCCH burst on each channel of the plan, in that order.  Each
+ * channel is handed to report as soon as it is done.  Returns the number of
+ * channels with a burst.
+ *
+ * The detector is the caller's if given, otherwise one is made for the scan.
+ */
+static int detect(usrp_source *u, const c0_chan *plan, unsigned int n, c0_report report, void *arg, fcch_detector *l)
 {
-	int i, tuner_gain;
-	unsigned int overruns, b_len, frames_len, found_count, r;
-	float offset, effective_offset, min_offset, max_offset, snr = 0.0f;
-	double freq, sps, power;
-	complex *b;
-	circular_buffer *ub;
-	fcch_detector *detector = new fcch_detector(u->sample_rate());
-
-	if(bi == BI_NOT_DEFINED)
-	{
-		fprintf(stderr, "error: c0_detect: band not defined\n");
-		return -1;
-	}
+	int found_count;
+	unsigned int i, frames_len, step_len, overlap, start, end, overruns, r;
+	float offset, effective_offset, snr;
+	double sps;
+	unsigned long long t;
+	typed_circular_buffer<complex> *ub;
+	typed_circular_buffer<complex>::view b;
+	fcch_detector *detector;
+	kal_channel c;
 
+	detector = l? l : new fcch_detector(u->sample_rate());
 	sps = u->sample_rate() / GSM_RATE;
 	frames_len = (unsigned int)ceil((12 * 8 * 156.25 + 156.25) * sps);
+	step_len = (unsigned int)ceil(C0_STEP_FRAMES * 8 * 156.25 * sps);
+	overlap = (unsigned int)ceil(8 * 156.25 * sps);
 	ub = u->get_buffer();
 
 	u->start();
 	u->flush();
 	found_count = 0;
-	for(i = first_chan(bi); i >= 0; i = next_chan(i, bi))
+	for(i = 0; i < n; i++)
 	{
-		freq = arfcn_to_freq(i, &bi);
-		if(!u->tune(freq))
+		c.chan = plan[i].chan;
+		c.band = plan[i].bi;
+		c.freq = plan[i].freq;
+		profile_channel(c.chan);
+		if(!u->tune(c.freq))
 		{
 			fprintf(stderr, "error: usrp_source::tune\n");
-			return -1;
+			found_count = -1;
+			break;
 		}
-		if (isatty(1) && g_verbosity == 0)
+		detector->retune(c.freq);
+		t = profile_start();
+		usleep(50000);
+		profile_stop(PROF_SETTLE, t);
+		if(capture(u, step_len))
 		{
-			printf("...chan %4i\r", i);
-			fflush(stdout);
+			fprintf(stderr, "error: usrp_source::fill\n");
+			found_count = -1;
+			break;
 		}
-		usleep(50000);
-		do
+
+		snr = 0.0f;
+		c.found = 0;
+		start = 0;
+		for(;;)
 		{
-			u->flush();
-			if(u->fill(frames_len, &overruns))
+			b = ub->readable();
+			end = std::min(b.len, frames_len);
+			r = detector->scan(b.data + start, end - start, &offset, 0, &snr);
+			effective_offset = offset - GSM_RATE / 4;
+			if(r && (fabsf(effective_offset) < ERROR_DETECT_OFFSET_MAX))
 			{
-				fprintf(stderr, "error: usrp_source::fill\n");
-				return -1;
+				c.found = 1;
+				break;
 			}
-		} while(overruns);
+			if(end >= frames_len)
+				break;
 
-		// first, we calculate the power in each channel
-		b = (complex *)ub->peek(&b_len);
-		power = sqrt(vectornorm2(b, frames_len) / frames_len);
+			start = end - overlap;
+			if(u->fill(std::min(end + step_len, frames_len), &overruns))
+				break;
 
-		r = detector->scan(b, b_len, &offset, 0, &snr);
-		effective_offset = offset - GSM_RATE / 4;
-		tuner_gain = u->get_tuner_gain();
-		if(r && (fabsf(effective_offset) < ERROR_DETECT_OFFSET_MAX))
-		{
-			// found
-			if (found_count)
+			// a gap in the samples, start the channel over
+			if(overruns)
 			{
-				min_offset = fmin(min_offset, effective_offset);
-				max_offset = fmax(max_offset, effective_offset);
+				if(capture(u, step_len))
+					break;
+				start = 0;
 			}
-			else
+		}
+		if(!c.found && (end < frames_len))
+		{
+			fprintf(stderr, "error: usrp_source::fill\n");
+			found_count = -1;
+			break;
+		}
+
+		// the power of what was captured
+		c.power = sqrt(vectornorm2(b.data, end) / end);
+		c.offset = c.found? effective_offset : 0.0f;
+		c.snr = snr;
+		c.tuner_gain = u->get_tuner_gain();
+		if(c.found)
+			found_count++;
+		if(report)
+			report(&c, arg);
+	}
+	u->stop();
+
+	if(detector != l)
+		delete detector;
+	return found_count;
+}
+
+
+// the given channels of band bi, in that order
+int c0_detect_chans(usrp_source *u, int bi, const int *chans, unsigned int n, c0_report report, void *arg, fcch_detector *l)
+{
+	c0_chan *plan;
+	unsigned int i;
+	int r;
+
+	if(bi == BI_NOT_DEFINED)
+	{
+		fprintf(stderr, "error: c0_detect: band not defined\n");
+		return -1;
+	}
+
+	plan = new c0_chan[n? n : 1];
+	for(i = 0; i < n; i++)
+	{
+		plan[i].chan = chans[i];
+		plan[i].bi = bi;
+		plan[i].freq = arfcn_to_freq(chans[i], &bi);
+	}
+	r = detect(u, plan, n, report, arg, l);
+	delete[] plan;
+	return r;
+}
+
+
+/*
+ * Measure the power of every channel from wideband captures, several channels
+ * per tune.  The power is the RMS sample value within the channel, like
+ * c0_detect_chans() measures it.  noise is the noise floor of the tune each
+ * channel was measured in, as the power of a channel.
+ */
+static int prescan(usrp_source *u, const c0_chan *plan, unsigned int n, double *power, double *noise)
+{
+	unsigned int i, j, k, m, nbins, decimation, bandwidth;
+	int lo, hi;
+	double fs, freq, center, wsum, *window, *spec, *bins, ms, quiet;
+	fftw_complex *in, *out;
+	fftw_plan fft;
+	typed_circular_buffer<complex> *cb;
+	complex *x;
+	unsigned long long t;
+	int r = 0;
+
+	decimation = (unsigned int)round(GSM_RATE * 6 / u->sample_rate());
+	bandwidth = u->bandwidth();
+	u->set_decimation(1);
+	u->set_bandwidth(PRESCAN_BW);
+	fs = u->sample_rate();
+	cb = u->get_buffer();
+
+	in = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * PRESCAN_FFT);
+	out = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * PRESCAN_FFT);
+	fft = fftw_plan_dft_1d(PRESCAN_FFT, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+	window = new double[PRESCAN_FFT];
+	spec = new double[PRESCAN_FFT];
+	bins = new double[PRESCAN_FFT];
+
+	// Hann, so that strong carriers don't leak into their neighbours
+	wsum = 0.0;
+	for(k = 0; k < PRESCAN_FFT; k++)
+	{
+		window[k] = 0.5 - 0.5 * cos(2 * M_PI * k / PRESCAN_FFT);
+		wsum += window[k] * window[k];
+	}
+
+	u->start();
+	for(i = 0; i < n; i = j)
+	{
+		// the channels that fit in this tune
+		center = plan[i].freq + PRESCAN_SPAN / 2;
+		for(j = i + 1; j < n; j++)
+		{
+			if(fabs(plan[j].freq - center) > PRESCAN_SPAN / 2)
+				break;
+		}
+
+		if(!u->tune(center))
+		{
+			fprintf(stderr, "error: usrp_source::tune\n");
+			r = -1;
+			break;
+		}
+		t = profile_start();
+		usleep(50000);
+		profile_stop(PROF_SETTLE, t);
+		if(capture(u, PRESCAN_FFT * PRESCAN_AVG))
+		{
+			fprintf(stderr, "error: usrp_source::fill\n");
+			r = -1;
+			break;
+		}
+
+		t = profile_start();
+		x = cb->readable().data;
+		memset(spec, 0, PRESCAN_FFT * sizeof(*spec));
+		for(m = 0; m < PRESCAN_AVG; m++, x += PRESCAN_FFT)
+		{
+			for(k = 0; k < PRESCAN_FFT; k++)
 			{
-				min_offset = max_offset = effective_offset;
+				in[k][0] = x[k].real() * window[k];
+				in[k][1] = x[k].imag() * window[k];
 			}
-			found_count++;
-			printf("    chan: %4d (%.1fMHz ", i, freq / 1e6);
-			display_freq(effective_offset);
-			printf(")    power: %5.0f \ttuner gain: %ddB \tsnr: %.0f\n", power, tuner_gain, snr);
+			fftw_execute(fft);
+			for(k = 0; k < PRESCAN_FFT; k++)
+				spec[k] += out[k][0] * out[k][0] + out[k][1] * out[k][1];
 		}
-		else if(g_verbosity > 0)
+
+		// the quiet bins of the channels, as much of them as a channel has
+		lo = (int)ceil((plan[i].freq - u->m_center_freq - PRESCAN_CHAN_BW / 2) / fs * PRESCAN_FFT);
+		hi = (int)floor((plan[j - 1].freq - u->m_center_freq + PRESCAN_CHAN_BW / 2) / fs * PRESCAN_FFT);
+		for(nbins = 0; lo <= hi; lo++)
+			bins[nbins++] = spec[(lo + PRESCAN_FFT) % PRESCAN_FFT];
+		std::nth_element(bins, bins + nbins / PRESCAN_FLOOR, bins + nbins);
+		quiet = bins[nbins / PRESCAN_FLOOR] * PRESCAN_CHAN_BW / fs * PRESCAN_FFT;
+
+		for(k = i; k < j; k++)
 		{
-			printf("    chan: %4d (%.1fMHz):\tpower: %5.0f \ttuner gain: %ddB \tsnr: %.0f\n",
-			   i, freq / 1e6, power, tuner_gain, snr);
+			freq = plan[k].freq - u->m_center_freq;
+			lo = (int)ceil((freq - PRESCAN_CHAN_BW / 2) / fs * PRESCAN_FFT);
+			hi = (int)floor((freq + PRESCAN_CHAN_BW / 2) / fs * PRESCAN_FFT);
+			ms = 0.0;
+			for(; lo <= hi; lo++)
+				ms += spec[(lo + PRESCAN_FFT) % PRESCAN_FFT];
+
+			// Parseval, undoing the window
+			power[k] = sqrt(ms / (PRESCAN_FFT * wsum * PRESCAN_AVG));
+			noise[k] = sqrt(quiet / (PRESCAN_FFT * wsum * PRESCAN_AVG));
 		}
+		profile_stop(PROF_PRESCAN, t, PRESCAN_FFT * PRESCAN_AVG);
+	}
+	u->stop();
 
+	fftw_destroy_plan(fft);
+	fftw_free(in);
+	fftw_free(out);
+	delete[] window;
+	delete[] spec;
+	delete[] bins;
+
+	u->set_decimation(decimation);
+	u->set_bandwidth(bandwidth);
+	return r;
+}
+
+
+static bool lower_freq(const c0_chan &a, const c0_chan &b)
+{
+	return a.freq < b.freq;
+}
+
+
+/*
+ * Every channel of the bands, in one sweep up in frequency.  That way the
+ * tuner crosses each of its own band switches once, and neighbouring
+ * channels share pre-scan tunes even if they belong to different bands.  A
+ * channel in more than one band, e.g., GSM-900 and E-GSM-900, is looked at
+ * once, for the band listed first.
+ *
+ * Unless g_prescan is off, a power pre-scan first drops the channels that
+ * are only noise, they are reported without an FCCH search.  The noise floor
+ * is per band and per tune, the gain of the tuner is not flat.  st, if given,
+ * says how long each stage took.
+ */
+int c0_detect_bands(usrp_source *u, const int *bands, unsigned int nb, c0_report report, void *arg, fcch_detector *l, c0_stats *st)
+{
+	c0_chan *plan = new c0_chan[C0_MAX_CHANS], *keep = new c0_chan[C0_MAX_CHANS];
+	double power[C0_MAX_CHANS], noise[C0_MAX_CHANS], sorted[C0_MAX_CHANS], band_floor[PCS_1900 + 1];
+	unsigned int n = 0, j, k, m, nkeep;
+	unsigned long long t0, t1;
+	kal_channel c;
+	int i, bi, r;
+
+	for(j = 0; j < nb; j++)
+	{
+		if((bands[j] <= BI_NOT_DEFINED) || (bands[j] > PCS_1900))
+		{
+			fprintf(stderr, "error: c0_detect: band not defined\n");
+			delete[] plan;
+			delete[] keep;
+			return -1;
+		}
+		for(i = first_chan(bands[j]); (i >= 0) && (n < C0_MAX_CHANS); i = next_chan(i, bands[j]))
+		{
+			bi = bands[j];
+			plan[n].chan = i;
+			plan[n].bi = bands[j];
+			plan[n].freq = arfcn_to_freq(i, &bi);
+			for(k = 0; (k < n) && (plan[k].freq != plan[n].freq); k++)
+				;
+			if(k == n)
+				n++;
+		}
 	}
-	printf("%d base stations found !\n", found_count);
+	std::stable_sort(plan, plan + n, lower_freq);
 
-	if (found_count == 1)
+	t0 = profile_now();
+	if(!g_prescan || !n)
+	{
+		r = detect(u, plan, n, report, arg, l);
+		nkeep = n;
+		t1 = t0;
+	}
+	else
 	{
-		printf("\n");
-		printf("Only one channel was found. This is unlikely and may "
-			"indicate you need to provide a rough estimate of the initial "
-			"PPM. It can be provided with the '-e' option. Try tuning against "
-			"a local FM radio or other known frequency first.\n");
+		profile_channel(-1);
+		if(prescan(u, plan, n, power, noise))
+		{
+			delete[] plan;
+			delete[] keep;
+			return -1;
+		}
+
+		for(j = 0; j < nb; j++)
+		{
+			for(k = m = 0; k < n; k++)
+			{
+				if(plan[k].bi == bands[j])
+					sorted[m++] = power[k];
+			}
+			if(!m)
+				continue;
+			std::nth_element(sorted, sorted + m / PRESCAN_FLOOR, sorted + m);
+			band_floor[bands[j]] = sorted[m / PRESCAN_FLOOR];
+		}
+
+		memset(&c, 0, sizeof(c));
+		c.tuner_gain = u->get_tuner_gain();
+		for(k = nkeep = 0; k < n; k++)
+		{
+			if(power[k] >= std::min(band_floor[plan[k].bi], noise[k]) * pow(10.0, PRESCAN_SNR / 20))
+			{
+				keep[nkeep++] = plan[k];
+				continue;
+			}
+			c.chan = plan[k].chan;
+			c.band = plan[k].bi;
+			c.freq = plan[k].freq;
+			c.power = power[k];
+			if(report)
+				report(&c, arg);
+		}
+		t1 = profile_now();
+		r = detect(u, keep, nkeep, report, arg, l);
 	}
 
-	/*
-	 * If the difference in offsets found is strangely large
-	 */
-	if (found_count > 1 && max_offset - min_offset > 1000)
+	if(st)
 	{
-		printf("\n");
-		printf("Difference of offsets between channels is >1kHz. This likely "
-			"means that the correct PPM is too far away and you need to provide "
-			"a rough estimate using the '-e' option. Try tuning against "
-			"a local FM radio or other known frequency first.\n");
+		st->chans = n;
+		st->checked = nkeep;
+		st->prescan_s = (t1 - t0) / 1e9;
+		st->detect_s = (profile_now() - t1) / 1e9;
 	}
-	return 0;
+	delete[] plan;
+	delete[] keep;
+	return r;
+}
+
+
+// every channel of band bi
+int c0_detect(usrp_source *u, int bi, c0_report report, void *arg, fcch_detector *l, c0_stats *st)
+{
+	return c0_detect_bands(u, &bi, 1, report, arg, l, st);
 }
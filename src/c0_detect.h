@@ -25,4 +25,23 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-int c0_detect(usrp_source *u, int bi);
+#include "libkal.h"
+
+class fcch_detector;
+
+// called with every channel as soon as it has been looked at
+typedef void (*c0_report)(const kal_channel *c, void *arg);
+
+#define C0_MAX_CHANS	1024	// more than all bands together have
+
+struct c0_stats
+{
+	unsigned int	chans,		// in the bands
+			checked;	// searched for an FCCH burst
+	double		prescan_s,
+			detect_s;
+};
+
+int c0_detect(usrp_source *u, int bi, c0_report report, void *arg, fcch_detector *l = 0, c0_stats *st = 0);
+int c0_detect_bands(usrp_source *u, const int *bands, unsigned int nb, c0_report report, void *arg, fcch_detector *l = 0, c0_stats *st = 0);
+int c0_detect_chans(usrp_source *u, int bi, const int *chans, unsigned int n, c0_report report, void *arg, fcch_detector *l = 0);
@@ -36,13 +36,19 @@
 #include <sys/ipc.h>
 #endif
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdexcept>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/stat.h>
 #ifndef D_HOST_OSX
 #ifndef _WIN32
 #include <sys/shm.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #endif
 #else
 #include <sys/mman.h>
@@ -54,10 +60,134 @@
 #ifndef D_HOST_OSX
 #ifndef _WIN32
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC	0x0001U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB	0x0004U
+#endif
+
+/*
+ * Linux can give us an anonymous file with memfd_create().  Mapping it twice
+ * into a reserved address range makes the mirror without System V segments,
+ * so there are no shmmax/shmmni limits, nothing to leak if we are killed, and
+ * no IPC namespace is needed.
+ *
+ * Called through syscall() as older C libraries don't have a wrapper.
+ */
+static int memfd_open(const char *name, unsigned int flags)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+	return syscall(SYS_memfd_create, name, flags);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/*
+ * The default huge page size from /proc/meminfo or 0 if there isn't one.
+ */
+static unsigned int huge_page_size()
+{
+	FILE *fp;
+	char line[128];
+	unsigned int kb = 0;
+
+	if(!(fp = fopen("/proc/meminfo", "r")))
+		return 0;
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(sscanf(line, "Hugepagesize: %u kB", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return kb * 1024;
+}
+
+
+/*
+ * Buffers at least a huge page long are first tried with hugetlb pages.  That
+ * fails unless the administrator reserved some, in which case we use normal
+ * pages and ask for transparent huge pages instead.
+ */
+int circular_buffer::map_memfd(unsigned int buf_size, const unsigned int huge)
+{
+	int fd;
+	unsigned int pagesize, thp, flags = MFD_CLOEXEC;
+	size_t len;
+	char *area, *base;
+
+	if(huge)
+	{
+		pagesize = huge;
+		flags |= MFD_HUGETLB;
+	} else
+		pagesize = getpagesize();
+	if(buf_size % pagesize)
+		buf_size = (buf_size + pagesize) & ~(pagesize - 1);
+	len = 2 * (size_t)pagesize + 2 * (size_t)buf_size;
+
+	if((fd = memfd_open("circular_buffer", flags)) == -1)
+		return -1;
+
+	if(ftruncate(fd, buf_size) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	// reserve an address range, aligned to the page size
+	if((area = (char *)mmap(0, len + pagesize, PROT_NONE,
+	   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		return -1;
+	}
+	base = (char *)(((unsigned long)area + pagesize - 1) &
+	   ~((unsigned long)pagesize - 1));
+	if(base > area)
+		munmap(area, base - area);
+	munmap(base + len, area + pagesize - base);
+
+	/*
+	 * Both copies replace part of the reservation, so, unlike with
+	 * shmat(), nobody else can take the range in between.  The rest of
+	 * the reservation stays as inaccessible guard pages.
+	 */
+	if((mmap(base + pagesize, buf_size, PROT_READ | PROT_WRITE,
+	   MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+	   (mmap(base + pagesize + buf_size, buf_size, PROT_READ | PROT_WRITE,
+	   MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+	{
+		munmap(base, len);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+#ifdef MADV_HUGEPAGE
+	if(!huge && (thp = huge_page_size()) && (buf_size >= thp))
+		madvise(base + pagesize, 2 * (size_t)buf_size, MADV_HUGEPAGE);
+#endif
+
+	m_base = base;
+	m_buf = base + pagesize;
+	m_buf_size = buf_size;
+	m_pagesize = pagesize;
+	m_memfd = 1;
+
+	return 0;
+}
+
+
 circular_buffer::circular_buffer(const unsigned int buf_len,
-   const unsigned int item_size, const unsigned int overwrite)
+   const unsigned int item_size, const unsigned int overwrite,
+   const unsigned int spsc)
 {
 	int shm_id_temp, shm_id_guard, shm_id_buf;
+	unsigned int huge;
 	void *base;
 
 	if(!buf_len)
@@ -66,10 +196,31 @@ circular_buffer::circular_buffer(const unsigned int buf_len,
 	if(!item_size)
 		throw std::runtime_error("circular_buffer: item size is 0");
 
+	if(overwrite && spsc)
+		throw std::runtime_error("circular_buffer: overwrite needs a lock");
+
 	// calculate buffer size
 	m_item_size = item_size;
 	m_buf_size = item_size * buf_len;
 
+	m_r = m_w = 0;
+	m_read = m_written = 0;
+	m_overwrite = overwrite;
+	m_spsc = spsc;
+	m_memfd = 0;
+
+	huge = huge_page_size();
+	if(((huge && (m_buf_size >= huge) && !map_memfd(m_buf_size, huge)) ||
+	   !map_memfd(m_buf_size, 0)))
+	{
+		m_buf_len = m_buf_size / item_size;
+		pthread_mutex_init(&m_mutex, 0);
+		pthread_cond_init(&m_cond, 0);
+		m_waiters = 0;
+		return;
+	}
+
+	// fall back to System V shared memory
 	m_pagesize = getpagesize();
 	if(m_buf_size % m_pagesize)
 		m_buf_size = (m_buf_size + m_pagesize) & ~(m_pagesize - 1);
@@ -180,12 +331,20 @@ circular_buffer::circular_buffer(const unsigned int buf_len,
 	m_item_size = item_size;
 
 	m_overwrite = overwrite;
+	m_spsc = spsc;
 
 	pthread_mutex_init(&m_mutex, 0);
+	pthread_cond_init(&m_cond, 0);
+	m_waiters = 0;
 }
 
 circular_buffer::~circular_buffer()
 {
+	if(m_memfd)
+	{
+		munmap(m_base, 2 * (size_t)m_pagesize + 2 * (size_t)m_buf_size);
+		return;
+	}
 	shmdt((char *)m_base + m_pagesize + 2 * m_buf_size);
 	shmdt((char *)m_base + m_pagesize + m_buf_size);
 	shmdt((char *)m_base + m_pagesize);
@@ -194,7 +353,8 @@ circular_buffer::~circular_buffer()
 
 #else
 circular_buffer::circular_buffer(const unsigned int buf_len,
-   const unsigned int item_size, const unsigned int overwrite)
+   const unsigned int item_size, const unsigned int overwrite,
+   const unsigned int spsc)
 {
 
 	if(!buf_len)
@@ -203,6 +363,9 @@ circular_buffer::circular_buffer(const unsigned int buf_len,
 	if(!item_size)
 		throw std::runtime_error("circular_buffer: item size is 0");
 
+	if(overwrite && spsc)
+		throw std::runtime_error("circular_buffer: overwrite needs a lock");
+
 	// calculate buffer size
 	m_item_size = item_size;
 	m_buf_size = item_size * buf_len;
@@ -270,8 +433,11 @@ circular_buffer::circular_buffer(const unsigned int buf_len,
 	m_item_size = item_size;
 
 	m_overwrite = overwrite;
+	m_spsc = spsc;
 
 	pthread_mutex_init(&m_mutex, 0);
+	pthread_cond_init(&m_cond, 0);
+	m_waiters = 0;
 
 }
 
@@ -292,7 +458,8 @@ circular_buffer::~circular_buffer()
  * was a reason.
  */
 circular_buffer::circular_buffer(const unsigned int buf_len,
-   const unsigned int item_size, const unsigned int overwrite)
+   const unsigned int item_size, const unsigned int overwrite,
+   const unsigned int spsc)
 {
 	int shm_fd;
 	char shm_name[255]; // XXX should be NAME_MAX
@@ -304,6 +471,9 @@ circular_buffer::circular_buffer(const unsigned int buf_len,
 	if(!item_size)
 		throw std::runtime_error("circular_buffer: item size is 0");
 
+	if(overwrite && spsc)
+		throw std::runtime_error("circular_buffer: overwrite needs a lock");
+
 	// calculate buffer size
 	m_item_size = item_size;
 	m_buf_size = item_size * buf_len;
@@ -397,8 +567,11 @@ circular_buffer::circular_buffer(const unsigned int buf_len,
 	m_item_size = item_size;
 
 	m_overwrite = overwrite;
+	m_spsc = spsc;
 
 	pthread_mutex_init(&m_mutex, 0);
+	pthread_cond_init(&m_cond, 0);
+	m_waiters = 0;
 }
 
 
@@ -409,6 +582,31 @@ circular_buffer::~circular_buffer()
 #endif /* !D_HOST_OSX */
 
 
+/*
+ * In single producer, single consumer mode, no lock is taken.  Only the
+ * consumer moves m_read and only the producer moves m_written; each side
+ * publishes its counter with release semantics after it is done with the
+ * data and reads the other side's counter with acquire semantics.  The byte
+ * offsets follow from the counters.
+ */
+static inline unsigned long long load_acquire(const unsigned long long *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+
+static inline void store_release(unsigned long long *p, unsigned long long v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+
+inline unsigned int circular_buffer::offset(unsigned long long count)
+{
+	return (count % m_buf_len) * m_item_size;
+}
+
+
 /*
  * The amount to read can only grow unless someone calls read after this is
  * called.  No real good way to tie the two together.
@@ -417,6 +615,9 @@ unsigned int circular_buffer::data_available()
 {
 	unsigned int amt;
 
+	if(m_spsc)
+		return load_acquire(&m_written) - load_acquire(&m_read);
+
 	pthread_mutex_lock(&m_mutex);
 	amt = m_written - m_read;	// item_size
 	pthread_mutex_unlock(&m_mutex);
@@ -429,6 +630,9 @@ unsigned int circular_buffer::space_available()
 {
 	unsigned int amt;
 
+	if(m_spsc)
+		return m_buf_len - (load_acquire(&m_written) - load_acquire(&m_read));
+
 	pthread_mutex_lock(&m_mutex);
 	amt = m_buf_len - (m_written - m_read);
 	pthread_mutex_unlock(&m_mutex);
@@ -450,18 +654,26 @@ unsigned int circular_buffer::space_available()
  */
 unsigned int circular_buffer::read(void *buf, const unsigned int buf_len)
 {
+	unsigned long long r;
 	unsigned int len;
 
+	if(m_spsc)
+	{
+		r = m_read;
+		len = load_acquire(&m_written) - r;
+		len = MIN(buf_len, len);
+		memcpy(buf, (char *)m_buf + offset(r), len * m_item_size);
+		store_release(&m_read, r + len);
+		wake();
+		return len;
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	len = MIN(buf_len, m_written - m_read);
 	memcpy(buf, (char *)m_buf + m_r, len * m_item_size);
 	m_read += len;
-	if(m_read == m_written)
-	{
-		m_r = m_w = 0;
-		m_read = m_written = 0;
-	} else
-		m_r = (m_r + len * m_item_size) % m_buf_size;
+	m_r = (m_r + len * m_item_size) % m_buf_size;
+	wake();
 	pthread_mutex_unlock(&m_mutex);
 
 	return len;
@@ -473,12 +685,24 @@ unsigned int circular_buffer::read(void *buf, const unsigned int buf_len)
  *
  *	Don't use read() while you are peek()'ing.  write() should be
  *	okay unless you have an overwrite buffer.
+ *
+ * One thread may write while another reads as neither read() nor purge()
+ * move the write position.  flush() does, so it needs both sides stopped.
  */
 void *circular_buffer::peek(unsigned int *buf_len)
 {
+	unsigned long long r;
 	unsigned int len;
 	void *p;
 
+	if(m_spsc)
+	{
+		r = m_read;
+		if(buf_len)
+			*buf_len = load_acquire(&m_written) - r;
+		return (char *)m_buf + offset(r);
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	len = m_written - m_read;
 	p = (char *)m_buf + m_r;
@@ -493,9 +717,18 @@ void *circular_buffer::peek(unsigned int *buf_len)
 
 void *circular_buffer::poke(unsigned int *buf_len)
 {
+	unsigned long long w;
 	unsigned int len;
 	void *p;
 
+	if(m_spsc)
+	{
+		w = m_written;
+		if(buf_len)
+			*buf_len = m_buf_len - (w - load_acquire(&m_read));
+		return (char *)m_buf + offset(w);
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	len = m_buf_len - (m_written - m_read);
 	p = (char *)m_buf + m_w;
@@ -510,18 +743,24 @@ void *circular_buffer::poke(unsigned int *buf_len)
 
 unsigned int circular_buffer::purge(const unsigned int buf_len)
 {
+	unsigned long long r;
 	unsigned int len;
 
+	if(m_spsc)
+	{
+		r = m_read;
+		len = load_acquire(&m_written) - r;
+		len = MIN(buf_len, len);
+		store_release(&m_read, r + len);
+		wake();
+		return len;
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	len = MIN(buf_len, m_written - m_read);
 	m_read += len;
-	if(m_read == m_written)
-	{
-		m_r = m_w = 0;
-		m_read = m_written = 0;
-	}
-	else
-		m_r = (m_r + len * m_item_size) % m_buf_size;
+	m_r = (m_r + len * m_item_size) % m_buf_size;
+	wake();
 	pthread_mutex_unlock(&m_mutex);
 
 	return len;
@@ -532,8 +771,20 @@ unsigned int circular_buffer::write(const void *buf,
    const unsigned int buf_len)
 {
 
+	unsigned long long w;
 	unsigned int len, buf_off = 0;
 
+	if(m_spsc)
+	{
+		w = m_written;
+		len = m_buf_len - (w - load_acquire(&m_read));
+		len = MIN(buf_len, len);
+		memcpy((char *)m_buf + offset(w), buf, len * m_item_size);
+		store_release(&m_written, w + len);
+		wake();
+		return len;
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	if(m_overwrite)
 	{
@@ -555,6 +806,7 @@ unsigned int circular_buffer::write(const void *buf,
 		m_read = m_written - m_buf_len;
 		m_r = m_w;
 	}
+	wake();
 	pthread_mutex_unlock(&m_mutex);
 
 	return len;
@@ -563,18 +815,34 @@ unsigned int circular_buffer::write(const void *buf,
 
 void circular_buffer::wrote(unsigned int len)
 {
+	if(m_spsc)
+	{
+		store_release(&m_written, m_written + len);
+		wake();
+		return;
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	m_written += len;
 	m_w = (m_w + len * m_item_size) % m_buf_size;
+	wake();
 	pthread_mutex_unlock(&m_mutex);
 }
 
 
 void circular_buffer::flush()
 {
+	if(m_spsc)
+	{
+		flush_nolock();
+		wake();
+		return;
+	}
+
 	pthread_mutex_lock(&m_mutex);
 	m_read = m_written = 0;
 	m_r = m_w = 0;
+	wake();
 	pthread_mutex_unlock(&m_mutex);
 }
 
@@ -586,6 +854,98 @@ void circular_buffer::flush_nolock() {
 }
 
 
+/*
+ * Wake anyone waiting in wait_for_data() or wait_for_space().  Without spsc,
+ * the caller holds the lock.
+ *
+ * In spsc mode, the lock is only taken if there is a waiter.  The fence
+ * orders the counter update before the check of m_waiters and the waiter
+ * does the opposite, so either we see the waiter or it sees the update.
+ */
+void circular_buffer::wake()
+{
+	if(m_spsc)
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(!__atomic_load_n(&m_waiters, __ATOMIC_RELAXED))
+			return;
+		pthread_mutex_lock(&m_mutex);
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+	}
+	else if(m_waiters)
+		pthread_cond_broadcast(&m_cond);
+}
+
+
+/*
+ * Sleep until at least len items (or len items of space if space is set)
+ * are available.  A negative timeout, in seconds, waits forever.
+ *
+ * Returns 0 when they are available and -1 on timeout or if len is larger
+ * than the buffer.
+ */
+int circular_buffer::wait(const unsigned int len, const double timeout,
+   const unsigned int space)
+{
+	struct timeval tv;
+	struct timespec ts;
+	unsigned long long w, r;
+	unsigned int avail;
+	int e = 0;
+
+	if(len > m_buf_len)
+		return -1;
+
+	if(timeout >= 0)
+	{
+		gettimeofday(&tv, 0);
+		ts.tv_sec = tv.tv_sec + (time_t)timeout;
+		ts.tv_nsec = tv.tv_usec * 1000 +
+		   (long)((timeout - (time_t)timeout) * 1e9);
+		if(ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	__atomic_add_fetch(&m_waiters, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for(;;)
+	{
+		w = load_acquire(&m_written);
+		r = load_acquire(&m_read);
+		avail = space? m_buf_len - (w - r) : w - r;
+		if((avail >= len) || e)
+			break;
+		if(timeout >= 0)
+			e = pthread_cond_timedwait(&m_cond, &m_mutex, &ts);
+		else
+			pthread_cond_wait(&m_cond, &m_mutex);
+	}
+	__atomic_sub_fetch(&m_waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&m_mutex);
+
+	return (avail >= len)? 0 : -1;
+}
+
+
+int circular_buffer::wait_for_data(const unsigned int len,
+   const double timeout)
+{
+	return wait(len, timeout, 0);
+}
+
+
+int circular_buffer::wait_for_space(const unsigned int len,
+   const double timeout)
+{
+	return wait(len, timeout, 1);
+}
+
+
 void circular_buffer::lock()
 {
 	pthread_mutex_lock(&m_mutex);
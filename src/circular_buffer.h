@@ -49,9 +49,11 @@
 #include <Windows.h>
 #endif
 
+#define CACHE_LINE 64
+
 class circular_buffer {
 public:
-	circular_buffer(const unsigned int buf_len, const unsigned int item_size = 1, const unsigned int overwrite = 0);
+	circular_buffer(const unsigned int buf_len, const unsigned int item_size = 1, const unsigned int overwrite = 0, const unsigned int spsc = 0);
 	~circular_buffer();
 
 	unsigned int read(void *buf, const unsigned int buf_len);
@@ -62,6 +64,8 @@ public:
 	unsigned int write(const void *buf, const unsigned int buf_len);
 	unsigned int data_available();
 	unsigned int space_available();
+	int wait_for_data(const unsigned int len, const double timeout = -1.0);
+	int wait_for_space(const unsigned int len, const double timeout = -1.0);
 	void flush();
 	void flush_nolock();
 	void lock();
@@ -74,16 +78,86 @@ private:
 	LPVOID d_first_copy;
 	LPVOID d_second_copy;
 #endif
+	unsigned int offset(unsigned long long count);
+	int wait(const unsigned int len, const double timeout, const unsigned int space);
+	void wake();
+
 	void *m_buf;
 	unsigned int m_buf_len, m_buf_size, m_r, m_w, m_item_size;
-	unsigned long long m_read, m_written;
 
 	unsigned int m_overwrite;
+	unsigned int m_spsc;
+
+	/*
+	 * Keep the consumer's and the producer's counters on separate cache
+	 * lines so that they don't bounce between cores in spsc mode.
+	 */
+	char m_pad0[CACHE_LINE];
+	unsigned long long m_read;
+	char m_pad1[CACHE_LINE - sizeof(unsigned long long)];
+	unsigned long long m_written;
+	char m_pad2[CACHE_LINE - sizeof(unsigned long long)];
 
 #ifndef _WIN32
+	int map_memfd(unsigned int buf_size, const unsigned int huge);
+
 	void *m_base;
 	unsigned int m_pagesize;
+	unsigned int m_memfd;
 #endif
 
 	pthread_mutex_t	m_mutex;
+	pthread_cond_t	m_cond;
+	unsigned int	m_waiters;
+};
+
+
+/*
+ * typed_circular_buffer
+ *
+ *	A circular_buffer of items of type T.  Since the buffer is mapped twice,
+ *	readable() and writable() always return contiguous views and no copy is
+ *	needed.  Producers fill the writable view and commit() what they wrote,
+ *	consumers use the readable view and consume() what they are done with.
+ *	Each commit() or consume() is a single index update, however many items
+ *	it covers.
+ *
+ *	sizeof(T) should divide the page size.
+ */
+template <class T>
+class typed_circular_buffer {
+public:
+	struct view {
+		T		*data;
+		unsigned int	len;
+	};
+
+	typed_circular_buffer(const unsigned int buf_len, const unsigned int overwrite = 0, const unsigned int spsc = 0) : m_cb(buf_len, sizeof(T), overwrite, spsc) {};
+
+	view readable() {
+		view v;
+		v.data = (T *)m_cb.peek(&v.len);
+		return v;
+	};
+	view writable() {
+		view v;
+		v.data = (T *)m_cb.poke(&v.len);
+		return v;
+	};
+	unsigned int consume(const unsigned int len) { return m_cb.purge(len); };
+	void commit(const unsigned int len) { m_cb.wrote(len); };
+	unsigned int write(const T *buf, const unsigned int len) { return m_cb.write(buf, len); };
+	unsigned int read(T *buf, const unsigned int len) { return m_cb.read(buf, len); };
+	unsigned int data_available() { return m_cb.data_available(); };
+	unsigned int space_available() { return m_cb.space_available(); };
+	int wait_for_data(const unsigned int len, const double timeout = -1.0) { return m_cb.wait_for_data(len, timeout); };
+	int wait_for_space(const unsigned int len, const double timeout = -1.0) { return m_cb.wait_for_space(len, timeout); };
+	void flush() { m_cb.flush(); };
+	unsigned int buf_len() { return m_cb.buf_len(); };
+
+private:
+	typed_circular_buffer(const typed_circular_buffer &);
+	typed_circular_buffer &operator=(const typed_circular_buffer &);
+
+	circular_buffer	m_cb;
 };
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include "ddc.h"
+
+
+ddc::ddc(const float sample_rate, const float shift, const unsigned int decimation, const float cutoff)
+{
+	unsigned int i;
+	double fc, x, h, win;
+
+	m_sample_rate = sample_rate;
+	m_decimation = decimation;
+	m_w = 2.0 * M_PI * shift / sample_rate;
+
+	/*
+	 * Hamming windowed sinc low pass, moved up to the channel so that
+	 *
+	 * 	y[k] = exp(-jwDk) * sum(h[i] * exp(jwi) * x[Dk - i])
+	 */
+	fc = cutoff / sample_rate;
+	m_taps = new complex[TAPS];
+	for(i = 0; i < TAPS; i++)
+	{
+		x = (double)i - (TAPS - 1) / 2.0;
+		h = (x == 0.0)? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+		win = 0.54 - 0.46 * cos(2.0 * M_PI * i / (TAPS - 1));
+		m_taps[i] = std::polar(h * win, m_w * i);
+	}
+}
+
+
+ddc::~ddc()
+{
+	delete[] m_taps;
+}
+
+
+unsigned int ddc::out_len(const unsigned int in_len)
+{
+	if(in_len < TAPS)
+		return 0;
+	return (in_len - TAPS) / m_decimation + 1;
+}
+
+
+float ddc::sample_rate()
+{
+	return m_sample_rate / m_decimation;
+}
+
+
+/*
+ * Returns the number of samples written to out, which must have room for
+ * out_len(in_len) samples.
+ */
+unsigned int ddc::process(const complex *in, const unsigned int in_len, complex *out)
+{
+	unsigned int i, k, n, len;
+	complex acc;
+	const complex *x;
+
+	len = out_len(in_len);
+	for(k = 0; k < len; k++)
+	{
+		// newest sample of this output
+		n = k * m_decimation + TAPS - 1;
+		x = in + n;
+		acc = 0.0;
+		for(i = 0; i < TAPS; i++)
+			acc += m_taps[i] * x[-(int)i];
+		out[k] = acc * std::polar(1.0f, (float)-fmod(m_w * n, 2.0 * M_PI));
+	}
+
+	return len;
+}
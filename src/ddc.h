@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * ddc
+ *
+ * Digital down converter.  Shifts one channel of a wideband capture to
+ * baseband, low pass filters and decimates it.  Shifting the filter taps
+ * instead of the input means only the decimated outputs need to be computed
+ * and rotated.
+ */
+
+#include "usrp_complex.h"
+
+class ddc {
+public:
+	ddc(const float sample_rate, const float shift, const unsigned int decimation, const float cutoff = 100e3);
+	~ddc();
+
+	unsigned int process(const complex *in, const unsigned int in_len, complex *out);
+	unsigned int out_len(const unsigned int in_len);
+	float sample_rate();
+
+private:
+	static const unsigned int	TAPS = 63;
+
+	unsigned int	m_decimation;
+	float		m_sample_rate;
+	double		m_w;		// shift in radians per input sample
+	complex		*m_taps;
+};
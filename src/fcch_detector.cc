@@ -47,8 +47,26 @@
 #include <stdexcept>
 #include <string.h>
 #include "fcch_detector.h"
+#include "profile.h"
 
 extern int g_debug;
+extern int g_low_memory;
+
+static const float		MIN_PM		= 50.0;	// XXX arbitrary, depends on decimation
+static const float		LIMIT		= 0.7;	// of the average error
+static const unsigned int	X_LEN		= 8192;
+static const unsigned int	X_LEN_LOW	= 512;	// a page of samples
+static const unsigned int	E_LEN		= 1015808;
+
+/*
+ * LMS_VSS: mu = VSS_ALPHA * mu + VSS_GAMMA * |e|^2 / E, within VSS_MU_MIN and
+ * VSS_MU_MAX.  The error is relative to the input power so that the step
+ * doesn't depend on the gain.  NLMS is stable for mu below 2.
+ */
+static const float		VSS_ALPHA	= 0.97;
+static const float		VSS_GAMMA	= 0.01;
+static const float		VSS_MU_MIN	= 0.005;
+static const float		VSS_MU_MAX	= 1.0;
 
 #ifndef _WIN32
 static const char * const fftw_plan_name = ".kal_fftw_plan";
@@ -68,19 +86,45 @@ fcch_detector::fcch_detector(const float sample_rate, const unsigned int D,
 	m_p = p;
 	m_G = G;
 	m_e = 0.0;
+	m_mu = VSS_MU_MAX;
+	m_step = LMS_FIXED;
+	m_limit = LIMIT;
+	m_min_pm = MIN_PM;
+	low_to_high_init();
 
 	m_sample_rate = sample_rate;
 	m_fcch_burst_len =
 	   (unsigned int)(148.0 * (m_sample_rate / GSM_RATE));
+	m_min_fb_len = (unsigned int)(100 * (m_sample_rate / GSM_RATE));
 
-	m_filter_delay = 8;
-	m_w_len = 2 * m_filter_delay + 1;
+	m_w_len = LMS_W_LEN;
+	m_filter_delay = (m_w_len - 1) / 2;
 	m_w = new complex[m_w_len];
 	memset(m_w, 0, sizeof(complex) * m_w_len);
 
-	m_x_cb = new circular_buffer(8192, sizeof(complex), 0);
-	m_y_cb = new circular_buffer(8192, sizeof(complex), 1);
-	m_e_cb = new circular_buffer(1015808, sizeof(float), 0);
+	m_cache = 0;
+	m_cache_len = 0;
+	m_cache_size = 0;
+	m_cache_clock = 0;
+	m_freq = 0.0;
+	get_state(&m_initial);
+
+	/*
+	 * With the low memory profile, the errors aren't kept but computed
+	 * twice by scan_streaming().
+	 */
+	if(g_low_memory)
+	{
+		m_x_cb = new typed_circular_buffer<complex>(X_LEN_LOW, 0, 1);
+		m_y_cb = new typed_circular_buffer<complex>(X_LEN_LOW, 1);
+		m_e_cb = 0;
+	}
+	else
+	{
+		m_x_cb = new typed_circular_buffer<complex>(X_LEN, 0, 1);
+		m_y_cb = new typed_circular_buffer<complex>(X_LEN, 1);
+		m_e_cb = new typed_circular_buffer<float>(E_LEN, 0, 1);
+	}
 
 	m_in = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * FFT_SIZE);
 	m_out = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * FFT_SIZE);
@@ -122,6 +166,11 @@ fcch_detector::~fcch_detector()
 		delete[] m_w;
 		m_w = 0;
 	}
+	if(m_cache)
+	{
+		delete[] m_cache;
+		m_cache = 0;
+	}
 	if(m_x_cb)
 	{
 		delete m_x_cb;
@@ -145,39 +194,36 @@ enum {
 	HIGH	= 1
 };
 
-static unsigned int g_count = 0,
-		    g_block_s = HIGH;
-
 
-static inline void low_to_high_init()
+void fcch_detector::low_to_high_init()
 {
-	g_count = 0;
-	g_block_s = HIGH;
+	m_count = 0;
+	m_block_s = HIGH;
 }
 
 
-static inline unsigned int low_to_high(float e, float a)
+inline unsigned int fcch_detector::low_to_high(float e, float a)
 {
 	unsigned int r = 0;
 
 	if(e > a)
 	{
-		if(g_block_s == LOW)
+		if(m_block_s == LOW)
 		{
-			r = g_count;
-			g_block_s = HIGH;
-			g_count = 0;
+			r = m_count;
+			m_block_s = HIGH;
+			m_count = 0;
 		}
-		g_count += 1;
+		m_count += 1;
 	}
 	else
 	{
-		if(g_block_s == HIGH)
+		if(m_block_s == HIGH)
 		{
-			g_block_s = LOW;
-			g_count = 0;
+			m_block_s = LOW;
+			m_count = 0;
 		}
-		g_count += 1;
+		m_count += 1;
 	}
 
 	return r;
@@ -212,7 +258,7 @@ static inline complex interpolate_point(const complex *s, const unsigned int s_l
 }
 
 
-static inline float peak_detect(const complex *s, const unsigned int s_len, complex *peak, float *avg_power)
+float peak_detect(const complex *s, const unsigned int s_len, complex *peak, float *avg_power)
 {
 	unsigned int i;
 	float max = -1.0, max_i = -1.0, sample_power, sum_power, early_i, late_i, incr;
@@ -280,6 +326,7 @@ static inline float itof(float index, float sample_rate, unsigned int fft_size)
 
 float fcch_detector::freq_detect(const complex *s, const unsigned int s_len, float *pm)
 {
+	unsigned long long t = profile_start(), p;
 	unsigned int i, len;
 	float max_i, avg_power;
 	complex fft[FFT_SIZE], peak;
@@ -301,48 +348,99 @@ float fcch_detector::freq_detect(const complex *s, const unsigned int s_len, flo
 	for(i = 0; i < FFT_SIZE; i++)
 		fft[i] = complex(m_out[i][0], m_out[i][1]);
 
+	p = profile_start();
 	max_i = peak_detect(fft, FFT_SIZE, &peak, &avg_power);
+	profile_stop(PROF_PEAK_DETECT, p, FFT_SIZE);
 	if(pm)
 		*pm = norm(peak) / avg_power;
+	profile_stop(PROF_FREQ_DETECT, t, len);
 	return itof(max_i, m_sample_rate, FFT_SIZE);
 }
 
 
+/*
+ * Feed the error of sample i to the run detector.  When a low error run long
+ * enough for an FCCH burst ends, check if it was a pure tone and set snr to
+ * its peak to mean ratio.
+ *
+ * Returns 1 if it was, with its frequency in offset and its start in
+ * y_offset.
+ */
+inline int fcch_detector::check_run(const complex *s, const unsigned int i, const float e, const float limit, float *offset, float *snr, unsigned int *y_offset)
+{
+	unsigned int l_count, y_len;
+	float pm;
+
+	l_count = low_to_high(e, limit);
+	if(l_count < m_min_fb_len)
+		return 0;
+
+	// see if p/m indicates a pure tone
+	*y_offset = i - l_count;
+	y_len = (l_count < m_fcch_burst_len)? l_count : m_fcch_burst_len;
+	*offset = freq_detect(s + *y_offset, y_len, &pm);
+	if(snr)
+		*snr = pm;
+	if(g_debug)
+		printf("debug: %.0f\t%f\t%f\n", (double)l_count * GSM_RATE / m_sample_rate, pm, *offset);
+	return (pm > m_min_pm);
+}
+
+
 /*
  * scan:
  * 	1.  calculate average error
  * 	2.  find neighborhoods with low error that satisfy minimum length
  * 	3.  for each such neighborhood, take fft and calculate peak/mean
  * 	4.  if peak/mean > 50, then this is a valid finding.
+ *
+ * If burst_pos is given, it receives the index in s where the low error
+ * neighborhood of the detected burst starts.
  */
-unsigned int fcch_detector::scan(const complex *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr)
+unsigned int fcch_detector::scan(const complex *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos)
 {
-	static const float sps = m_sample_rate / (1625000.0 / 6.0);
-	static const unsigned int MIN_FB_LEN = 100 * sps;
-	static const unsigned int MIN_PM = 50; // XXX arbitrary, depends on decimation
-	unsigned int len = 0, t, e_count, i, l_count, y_offset, y_len;
-	float e, *a, loff = 0, pm;
+	unsigned int len = 0, n, e_count, i, y_offset = 0, found = 0;
+	float *a, loff = 0;
 	double sum = 0.0, avg, limit;
-	const complex *y;
+	typed_circular_buffer<complex>::view x;
+	typed_circular_buffer<float>::view e;
+	unsigned long long t;
 
-	// calculate the error for each sample
+	if(!m_e_cb)
+		return scan_streaming(s, s_len, offset, consumed, snr, burst_pos);
+
+	/*
+	 * Calculate the error for each sample.  The input goes through the
+	 * x buffer a batch at a time so that the filter always sees its
+	 * history contiguously.
+	 */
+	t = profile_start();
 	while(len < s_len)
 	{
-		t = m_x_cb->write(s + len, 1);
-		len += t;
-		if(!next_norm_error(&e))
+		len += m_x_cb->write(s + len, s_len - len);
+		x = m_x_cb->readable();
+		e = m_e_cb->writable();
+		for(n = 0; (n + m_w_len + m_D <= x.len) && (n < e.len); n++)
 		{
-			m_e_cb->write(&e, 1);
-			sum += e;
+			e.data[n] = norm_error(x.data + n);
+			sum += e.data[n];
 		}
+		m_y_cb->write(x.data + m_w_len - 1 + m_D, n);
+		m_x_cb->consume(n);
+		m_e_cb->commit(n);
+		if(!e.len)
+			break;
 	}
+	profile_stop(PROF_ERROR, t, len);
 	if(consumed)
 		*consumed = len;
 
 	// calculate average error over entire buffer
-	a = (float *)m_e_cb->peek(&e_count);
+	e = m_e_cb->readable();
+	a = e.data;
+	e_count = e.len;
 	avg = sum / (double)e_count;
-	limit = 0.7 * avg;
+	limit = m_limit * avg;
 
 	if(g_debug)
 		printf("debug: error limit: %.1lf\n", limit);
@@ -351,35 +449,27 @@ unsigned int fcch_detector::scan(const complex *s, const unsigned int s_len, flo
 	low_to_high_init();
 	for(i = 0; i < e_count; i++)
 	{
-		l_count = low_to_high(a[i], limit);
-
-		// see if p/m indicates a pure tone
-		pm = 0;
-		if(l_count >= MIN_FB_LEN)
+		if(check_run(s, i, a[i], limit, &loff, snr, &y_offset))
 		{
-			y_offset = i - l_count;
-			y_len = (l_count < m_fcch_burst_len)? l_count : m_fcch_burst_len;
-			y = s + y_offset;
-			loff = freq_detect(y, y_len, &pm);
-			if(snr)
-				*snr = pm;
-			if(g_debug)
-				printf("debug: %.0f\t%f\t%f\n", (double)l_count / sps, pm, loff);
-			if(pm > MIN_PM)
-				break;
+			found = 1;
+			break;
 		}
 	}
+
 	// empty buffers for next call
 	m_e_cb->flush();
 	m_x_cb->flush();
 	m_y_cb->flush();
 
-	if(pm <= MIN_PM)
+	if(!found)
 		return 0;
 
 	if(offset)
 		*offset = loff;
 
+	if(burst_pos)
+		*burst_pos = y_offset;
+
 	if(g_debug)
 		printf("debug: fcch_detector finished -----------------------------\n");
 
@@ -387,6 +477,89 @@ unsigned int fcch_detector::scan(const complex *s, const unsigned int s_len, flo
 }
 
 
+/*
+ * The same as scan() but without storing the error signal.  The first pass
+ * only sums the errors.  The second runs the filter again from the same
+ * state and looks for low error runs as the errors come out.  The filter is
+ * left as the first pass left it so that the result is the same as scan()'s.
+ */
+unsigned int fcch_detector::scan_streaming(const complex *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos)
+{
+	unsigned int len, n, e_count, i, y_offset = 0, pass, found = 0;
+	float loff = 0, e;
+	double sum = 0.0, limit = 0.0;
+	typed_circular_buffer<complex>::view x;
+	lms_state start, end;
+	unsigned long long t = profile_start();
+
+	// both passes count as the error pass, with the run checks of the second
+	get_state(&start);
+	for(pass = 0; pass < 2; pass++)
+	{
+		low_to_high_init();
+		for(len = 0, i = 0; (len < s_len) && !found; )
+		{
+			len += m_x_cb->write(s + len, s_len - len);
+			x = m_x_cb->readable();
+			for(n = 0; n + m_w_len + m_D <= x.len; n++, i++)
+			{
+				e = norm_error(x.data + n);
+				if(!pass)
+					sum += e;
+				else if(check_run(s, i, e, limit, &loff, snr, &y_offset))
+				{
+					found = 1;
+					break;
+				}
+			}
+			m_y_cb->write(x.data + m_w_len - 1 + m_D, n);
+			m_x_cb->consume(n);
+		}
+		m_x_cb->flush();
+		if(!pass)
+		{
+			e_count = i;
+			limit = m_limit * sum / (double)e_count;
+			if(g_debug)
+				printf("debug: error limit: %.1lf\n", limit);
+			get_state(&end);
+			set_state(&start);
+		}
+	}
+	set_state(&end);
+	m_y_cb->flush();
+	profile_stop(PROF_ERROR, t, s_len);
+
+	if(consumed)
+		*consumed = s_len;
+
+	if(!found)
+		return 0;
+
+	if(offset)
+		*offset = loff;
+
+	if(burst_pos)
+		*burst_pos = y_offset;
+
+	if(g_debug)
+		printf("debug: fcch_detector finished -----------------------------\n");
+
+	return 1;
+}
+
+
+/*
+ * A run is a candidate while its error stays below limit times the average
+ * error, and a burst if its spectrum's peak to mean is above min_pm.
+ */
+void fcch_detector::set_thresholds(const float limit, const float min_pm)
+{
+	m_limit = limit;
+	m_min_pm = min_pm;
+}
+
+
 unsigned int fcch_detector::update(const complex *s, const unsigned int s_len)
 {
 	return m_x_cb->write(s, s_len);
@@ -426,29 +599,56 @@ static float vectornorm2(const complex *v, const unsigned int len)
  */
 int fcch_detector::next_norm_error(float *error)
 {
-	unsigned int i, n, max;
-	float E;
-	complex *x, y, e;
+	unsigned int n;
+	typed_circular_buffer<complex>::view x;
+	float e;
 
 	// n is "current" sample
 	n = m_w_len - 1;
 
 	// ensure there are enough samples in the buffer
-	x = (complex *)m_x_cb->peek(&max);
-	if(n + m_D >= max)
-		return n + m_D - max + 1;
+	x = m_x_cb->readable();
+	if(n + m_D >= x.len)
+		return n + m_D - x.len + 1;
+
+	e = norm_error(x.data);
+	m_y_cb->write(x.data + n + m_D, 1); // XXX save filtered value?
+
+	// return error ratio
+	if(error)
+		*error = e;
+
+	// remove the processed sample from the buffer
+	m_x_cb->consume(1);
+
+	return 0;
+}
+
+
+/*
+ * Run the filter once over x[0], ..., x[w_len - 1 + m_D] and return the
+ * error ratio for x[w_len - 1 + m_D].
+ */
+inline float fcch_detector::norm_error(const complex *x)
+{
+	unsigned int i, n;
+	float E;
+	complex y, e;
+
+	// n is "current" sample
+	n = m_w_len - 1;
 
 	// update G
 	E = vectornorm2(x, m_w_len);
-	if(m_G >= 2.0 / E)
+	if(m_step == LMS_VSS)
+		m_G = (E > 0.0)? m_mu / E : 0.0;
+	else if(m_G >= 2.0 / E)
 		m_G = 1.0 / E;
 
 	// calculate filtered value
 	y = 0.0;
 	for(i = 0; i < m_w_len; i++)
 		y += std::conj(m_w[i]) * x[n - i];
-	// m_y_cb->write(&y, 1);
-	m_y_cb->write(x + n + m_D, 1); // XXX save filtered value?
 
 	// calculate error from desired signal
 	e = x[n + m_D] - y;
@@ -461,26 +661,36 @@ int fcch_detector::next_norm_error(float *error)
 	E /= m_w_len;
 	m_e = (1.0 - m_p) * m_e + m_p * norm(e);
 
-	// return error ratio
-	if(error)
-		*error = m_e / E;
-
-	// remove the processed sample from the buffer
-	m_x_cb->purge(1);
+	if((m_step == LMS_VSS) && (E > 0.0))
+	{
+		m_mu = VSS_ALPHA * m_mu + VSS_GAMMA * norm(e) / E;
+		if(m_mu > VSS_MU_MAX)
+			m_mu = VSS_MU_MAX;
+		else if(m_mu < VSS_MU_MIN)
+			m_mu = VSS_MU_MIN;
+	}
 
-	return 0;
+	return m_e / E;
 }
 
 
 complex *fcch_detector::dump_x(unsigned int *x_len)
 {
-	return (complex *)m_x_cb->peek(x_len);
+	typed_circular_buffer<complex>::view x = m_x_cb->readable();
+
+	if(x_len)
+		*x_len = x.len;
+	return x.data;
 }
 
 
 complex *fcch_detector::dump_y(unsigned int *y_len)
 {
-	return (complex *)m_y_cb->peek(y_len);
+	typed_circular_buffer<complex>::view y = m_y_cb->readable();
+
+	if(y_len)
+		*y_len = y.len;
+	return y.data;
 }
 
 
@@ -498,5 +708,87 @@ unsigned int fcch_detector::x_buf_len()
 
 unsigned int fcch_detector::x_purge(unsigned int len)
 {
-	return m_x_cb->purge(len);
+	return m_x_cb->consume(len);
+}
+
+
+void fcch_detector::get_state(lms_state *s)
+{
+	memcpy(s->w, m_w, sizeof(complex) * m_w_len);
+	s->G = m_G;
+	s->e = m_e;
+	s->mu = m_mu;
+}
+
+
+void fcch_detector::set_state(const lms_state *s)
+{
+	memcpy(m_w, s->w, sizeof(complex) * m_w_len);
+	m_G = s->G;
+	m_e = s->e;
+	m_mu = s->mu;
+}
+
+
+// LMS_FIXED or LMS_VSS, from the current state
+void fcch_detector::set_step_size(const int mode)
+{
+	m_step = mode;
+}
+
+
+/*
+ * Called when the samples move to freq.  The state of the filter is kept for
+ * the frequency it was on and, if it has been on freq before, the state it
+ * left there comes back: the weights are still on that carrier's tone and
+ * the step size on its power, so the error drops as soon as the next FCCH
+ * burst comes.  On a frequency it hasn't been on, the filter starts over
+ * from the state it was constructed with rather than from the last carrier's,
+ * whose weights and step size would only slow it down on a weaker one.  When
+ * the cache is full, the frequency not seen for longest goes.
+ *
+ * Returns 1 if the filter was warm started.
+ */
+int fcch_detector::retune(const double freq)
+{
+	unsigned int i, j, oldest = 0;
+	lms_cache_entry *cache;
+
+	if(m_freq != 0.0)
+	{
+		for(i = 0; (i < m_cache_len) && (m_cache[i].freq != m_freq); i++)
+		{
+			if(m_cache[i].used < m_cache[oldest].used)
+				oldest = i;
+		}
+		if((i == m_cache_len) && (m_cache_len == m_cache_size) && (m_cache_size < LMS_CACHE_SIZE))
+		{
+			m_cache_size = m_cache_size? 2 * m_cache_size : LMS_CACHE_MIN;
+			cache = new lms_cache_entry[m_cache_size];
+			for(j = 0; j < m_cache_len; j++)
+				cache[j] = m_cache[j];
+			delete[] m_cache;
+			m_cache = cache;
+		}
+		if((i == m_cache_len) && (m_cache_len < m_cache_size))
+			m_cache_len++;
+		else if(i == m_cache_len)
+			i = oldest;
+		m_cache[i].freq = m_freq;
+		m_cache[i].used = ++m_cache_clock;
+		get_state(&m_cache[i].s);
+	}
+
+	m_freq = freq;
+	for(i = 0; i < m_cache_len; i++)
+	{
+		if(m_cache[i].freq == freq)
+		{
+			m_cache[i].used = ++m_cache_clock;
+			set_state(&m_cache[i].s);
+			return 1;
+		}
+	}
+	set_state(&m_initial);
+	return 0;
 }
@@ -41,17 +41,70 @@
  * code should take that into consideration.
  */
 
+#pragma once
+
 #include <fftw3.h>
 
 #include "circular_buffer.h"
 #include "usrp_complex.h"
 
+/*
+ * The adaptive filter's state, e.g., to run it over the same samples twice.
+ * The filter is symmetric around the current sample, so its length is odd.
+ */
+#define LMS_W_LEN 17
+
+#if LMS_W_LEN % 2 != 1
+#error "LMS_W_LEN must be odd"
+#endif
+
+struct lms_state {
+	complex	w[LMS_W_LEN];
+	float	G,
+		e,
+		mu;		// with LMS_VSS
+};
+
+/*
+ * The step size of the filter.  LMS_FIXED is the paper's, G only goes down
+ * to keep the filter stable.  LMS_VSS is NLMS with the variable step size of
+ *
+ *	Kwong, Raymond H., and Edward W. Johnston.  "A Variable Step Size LMS
+ *	Algorithm."  IEEE Transactions on Signal Processing 40.7 (1992).
+ *
+ * The step grows while the error is large, e.g., at the start of a burst,
+ * and shrinks once the filter has locked on the tone.
+ */
+enum {
+	LMS_FIXED,
+	LMS_VSS
+};
+
+/*
+ * The state the filter was left in on each frequency, see retune().  The
+ * cache grows as frequencies come, from LMS_CACHE_MIN entries, a band's worth
+ * is about 20 kB.
+ */
+#define LMS_CACHE_MIN 16
+#define LMS_CACHE_SIZE 1024
+
+struct lms_cache_entry {
+	double			freq;
+	unsigned long long	used;
+	lms_state		s;
+};
+
+/*
+ * The interpolated index of the strongest bin of the spectrum s.
+ */
+float peak_detect(const complex *s, const unsigned int s_len, complex *peak, float *avg_power);
+
 class fcch_detector {
 
 public:
 	fcch_detector(const float sample_rate, const unsigned int D = 8, const float p = 1.0 / 32.0, const float G = 1.0 / 12.5);
 	~fcch_detector();
-	unsigned int scan(const complex *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr);
+	unsigned int scan(const complex *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos = 0);
 	float freq_detect(const complex *s, const unsigned int s_len, float *pm);
 	unsigned int update(const complex *s, unsigned int s_len);
 	int next_norm_error(float *error);
@@ -63,23 +116,47 @@ public:
 	unsigned int x_buf_len();
 	unsigned int y_buf_len();
 	unsigned int x_purge(unsigned int);
+	void get_state(lms_state *s);
+	void set_state(const lms_state *s);
+	void set_thresholds(const float limit, const float min_pm);
+	int retune(const double freq);
+	void set_step_size(const int mode);
 
 private:
 #define GSM_RATE (1625000.0 / 6.0)
 #define FFT_SIZE 1024
 
+	void low_to_high_init();
+	unsigned int low_to_high(float e, float a);
+	float norm_error(const complex *x);
+	unsigned int scan_streaming(const complex *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos);
+	int check_run(const complex *s, const unsigned int i, const float e, const float limit, float *offset, float *pm, unsigned int *y_offset);
+
 	unsigned int	m_w_len,
 			m_D,
+			m_count,
+			m_block_s,
 			m_filter_delay,
-			m_fcch_burst_len;
+			m_fcch_burst_len,
+			m_min_fb_len;
+	int		m_step;
 	float		m_sample_rate,
 			m_p,
 			m_G,
-			m_e;
+			m_e,
+			m_mu,
+			m_limit,
+			m_min_pm;
 	complex 	*m_w;
-	circular_buffer *m_x_cb,
-			*m_y_cb,
-			*m_e_cb;
+	lms_cache_entry	*m_cache;
+	unsigned int	m_cache_len,
+			m_cache_size;
+	unsigned long long m_cache_clock;
+	double		m_freq;
+	lms_state	m_initial;
+	typed_circular_buffer<complex>	*m_x_cb,
+					*m_y_cb;
+	typed_circular_buffer<float>	*m_e_cb;
 
 	fftw_complex	*m_in, *m_out;
 	fftw_plan	m_plan;
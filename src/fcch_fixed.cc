@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The fixed point version of fcch_detector.  See fcch_detector.cc for the
+ * algorithm.
+ */
+
+#include <stdio.h>	// for debug
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "fcch_fixed.h"
+#include "profile.h"
+
+extern int g_debug;
+
+static const unsigned int	MIN_PM		= 50;	// as in fcch_detector
+static const unsigned int	X_LEN		= 8192;
+static const unsigned int	E_LEN		= 1015808;
+static const unsigned int	FFT_BITS	= 10;	// FFT_SIZE == 1 << FFT_BITS
+
+/*
+ * Below this window energy, about 3 LSB of the 8-bit samples, there is no
+ * signal to speak of.  It also bounds the step size.
+ */
+static const unsigned long long	E_MIN		= 1ULL << 18;
+
+
+static inline short sat16(int v)
+{
+	if(v > 32767)
+		return 32767;
+	if(v < -32768)
+		return -32768;
+	return v;
+}
+
+
+static inline int sat32(long long v)
+{
+	if(v > 2147483647LL)
+		return 2147483647;
+	if(v < -2147483647LL - 1)
+		return -2147483647 - 1;
+	return v;
+}
+
+
+fcch_detector_fixed::fcch_detector_fixed(const float sample_rate, const unsigned int D)
+{
+	unsigned int i;
+
+	if(FFT_SIZE != (1 << FFT_BITS))
+		throw std::runtime_error("fcch_detector_fixed: bad FFT_SIZE");
+
+	m_D = D;
+	m_w_len = LMS_W_LEN;
+	m_Eg = 0;
+	m_g = 0;
+	m_e = 0;
+	low_to_high_init();
+
+	m_sample_rate = sample_rate;
+	m_fcch_burst_len =
+	   (unsigned int)(148.0 * (m_sample_rate / GSM_RATE));
+	m_min_fb_len = (unsigned int)(100 * (m_sample_rate / GSM_RATE));
+
+	memset(m_w, 0, sizeof(m_w));
+	pack_taps();
+
+	m_x_cb = new typed_circular_buffer<complex16>(X_LEN, 0, 1);
+	m_e_cb = new typed_circular_buffer<unsigned int>(E_LEN, 0, 1);
+
+	// the twiddle factors are the only floating point left, once
+	m_fft = new int[2 * FFT_SIZE];
+	m_tw = new short[FFT_SIZE];
+	for(i = 0; i < FFT_SIZE / 2; i++)
+	{
+		m_tw[2 * i] = sat16((int)lrint(32767.0 * cos(2.0 * M_PI * i / FFT_SIZE)));
+		m_tw[2 * i + 1] = sat16((int)lrint(-32767.0 * sin(2.0 * M_PI * i / FFT_SIZE)));
+	}
+}
+
+
+fcch_detector_fixed::~fcch_detector_fixed()
+{
+	delete m_x_cb;
+	delete m_e_cb;
+	delete[] m_fft;
+	delete[] m_tw;
+}
+
+
+enum {
+	LOW	= 0,
+	HIGH	= 1
+};
+
+
+void fcch_detector_fixed::low_to_high_init()
+{
+	m_count = 0;
+	m_block_s = HIGH;
+}
+
+
+inline unsigned int fcch_detector_fixed::low_to_high(unsigned int e, unsigned int a)
+{
+	unsigned int r = 0;
+
+	if(e > a)
+	{
+		if(m_block_s == LOW)
+		{
+			r = m_count;
+			m_block_s = HIGH;
+			m_count = 0;
+		}
+		m_count += 1;
+	}
+	else
+	{
+		if(m_block_s == HIGH)
+		{
+			m_block_s = LOW;
+			m_count = 0;
+		}
+		m_count += 1;
+	}
+
+	return r;
+}
+
+
+/*
+ * Narrow the Q28 taps to the Q14 ones the dot product uses, saturating.
+ */
+inline void fcch_detector_fixed::pack_taps()
+{
+	unsigned int i;
+
+#if defined(__SSE2__)
+	const __m128i even = _mm_set1_epi32(0x0000ffff);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a, b;
+
+	for(i = 0; i < 2 * W16_LEN; i += 8)
+	{
+		a = _mm_packs_epi32(
+		   _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(m_w + i)), 14),
+		   _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(m_w + i + 4)), 14));
+		_mm_storeu_si128((__m128i *)(m_wa + i), a);
+
+		// (wr, wi) -> (-wi, wr)
+		b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, 0xb1), 0xb1);
+		b = _mm_or_si128(_mm_and_si128(even, _mm_subs_epi16(zero, b)),
+		   _mm_andnot_si128(even, b));
+		_mm_storeu_si128((__m128i *)(m_wb + i), b);
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	const uint16x4_t even = vreinterpret_u16_u32(vdup_n_u32(0x0000ffff));
+	int16x4_t a, b;
+
+	for(i = 0; i < 2 * W16_LEN; i += 4)
+	{
+		a = vqshrn_n_s32(vld1q_s32(m_w + i), 14);
+		vst1_s16(m_wa + i, a);
+
+		// (wr, wi) -> (-wi, wr)
+		b = vrev32_s16(a);
+		b = vbsl_s16(even, vqneg_s16(b), b);
+		vst1_s16(m_wb + i, b);
+	}
+#else
+	for(i = 0; i < 2 * W16_LEN; i += 2)
+	{
+		m_wa[i] = sat16(m_w[i] >> 14);
+		m_wa[i + 1] = sat16(m_w[i + 1] >> 14);
+		m_wb[i] = sat16(-(int)m_wa[i + 1]);
+		m_wb[i + 1] = m_wa[i];
+	}
+#endif
+}
+
+
+/*
+ * Window energy and conj(w) . x over the first W16_LEN samples of x.  The
+ * padding taps are zero and x always has w_len - 1 + D >= W16_LEN samples.
+ */
+static inline void filter_dot(const complex16 *x, const short *wa, const short *wb, unsigned long long *E, int *y_re, int *y_im)
+{
+	unsigned int i;
+
+#if defined(__SSE2__)
+	__m128i v, re = _mm_setzero_si128(), im = _mm_setzero_si128(), en = _mm_setzero_si128();
+	unsigned int t[4];
+	int r[4], q[4];
+
+	for(i = 0; i < 2 * W16_LEN; i += 8)
+	{
+		v = _mm_loadu_si128((const __m128i *)((const short *)x + i));
+		re = _mm_add_epi32(re, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(wa + i))));
+		im = _mm_add_epi32(im, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)(wb + i))));
+		// |x|**2 <= 2**29 for 14-bit samples, five fit the unsigned lanes
+		en = _mm_add_epi32(en, _mm_madd_epi16(v, v));
+	}
+	_mm_storeu_si128((__m128i *)t, en);
+	_mm_storeu_si128((__m128i *)r, re);
+	_mm_storeu_si128((__m128i *)q, im);
+	*E = (unsigned long long)t[0] + t[1] + t[2] + t[3];
+	*y_re = r[0] + r[1] + r[2] + r[3];
+	*y_im = q[0] + q[1] + q[2] + q[3];
+
+	// the loads above include padding samples beyond the window
+	for(i = LMS_W_LEN; i < W16_LEN; i++)
+		*E -= (long long)x[i].re * x[i].re + (long long)x[i].im * x[i].im;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	int32x4_t re = vdupq_n_s32(0), im = vdupq_n_s32(0);
+	uint64x2_t en = vdupq_n_u64(0);
+	int16x4_t v;
+	int32x4_t p;
+
+	for(i = 0; i < 2 * W16_LEN; i += 4)
+	{
+		v = vld1_s16((const short *)x + i);
+		re = vmlal_s16(re, v, vld1_s16(wa + i));
+		im = vmlal_s16(im, v, vld1_s16(wb + i));
+		p = vmull_s16(v, v);
+		en = vpadalq_u32(en, vreinterpretq_u32_s32(p));
+	}
+	*E = vgetq_lane_u64(en, 0) + vgetq_lane_u64(en, 1);
+	*y_re = vgetq_lane_s32(re, 0) + vgetq_lane_s32(re, 1) + vgetq_lane_s32(re, 2) + vgetq_lane_s32(re, 3);
+	*y_im = vgetq_lane_s32(im, 0) + vgetq_lane_s32(im, 1) + vgetq_lane_s32(im, 2) + vgetq_lane_s32(im, 3);
+	for(i = LMS_W_LEN; i < W16_LEN; i++)
+		*E -= (long long)x[i].re * x[i].re + (long long)x[i].im * x[i].im;
+#else
+	unsigned long long e = 0;
+	int r = 0, q = 0;
+
+	for(i = 0; i < LMS_W_LEN; i++)
+	{
+		r += x[i].re * wa[2 * i] + x[i].im * wa[2 * i + 1];
+		q += x[i].re * wb[2 * i] + x[i].im * wb[2 * i + 1];
+		e += (long long)x[i].re * x[i].re + (long long)x[i].im * x[i].im;
+	}
+	*E = e;
+	*y_re = r;
+	*y_im = q;
+#endif
+}
+
+
+/*
+ * One step of the adaptive filter over x[0], ..., x[w_len - 1 + D], as in
+ * fcch_detector::norm_error().  Returns the error ratio in Q16.
+ */
+inline unsigned int fcch_detector_fixed::norm_error(const complex16 *x)
+{
+	unsigned int j, n;
+	unsigned long long E, r;
+	long long c_re, c_im, e2;
+	int y_re, y_im, e_re, e_im;
+
+	// n is "current" sample
+	n = m_w_len - 1;
+
+	filter_dot(x, m_wa, m_wb, &E, &y_re, &y_im);
+	if(E < E_MIN)
+		E = E_MIN;
+
+	// the step size only goes down, as G in fcch_detector
+	if(E >= 2 * m_Eg)
+	{
+		m_Eg = E;
+		m_g = (1ULL << 62) / m_Eg;
+	}
+
+	// calculate error from desired signal
+	e_re = x[n + m_D].re - (y_re >> 14);
+	e_im = x[n + m_D].im - (y_im >> 14);
+
+	// c = G * conj(e) in Q31
+	c_re = sat32(((long long)e_re * (long long)m_g) >> 31);
+	c_im = sat32(-(((long long)e_im * (long long)m_g) >> 31));
+
+	// update filters with opposite gradient
+	for(j = 0; j < m_w_len; j++)
+	{
+		m_w[2 * j] = sat32(m_w[2 * j] + ((c_re * x[j].re - c_im * x[j].im) >> 3));
+		m_w[2 * j + 1] = sat32(m_w[2 * j + 1] + ((c_re * x[j].im + c_im * x[j].re) >> 3));
+	}
+	pack_taps();
+
+	// update error average power, p = 1 / 32
+	e2 = (long long)e_re * e_re + (long long)e_im * e_im;
+	m_e += (e2 - m_e) >> 5;
+
+	// error ratio m_e / (E / w_len)
+	r = ((unsigned long long)m_e * m_w_len << 16) / E;
+	return (r > 0xffffffffULL)? 0xffffffff : r;
+}
+
+
+unsigned int fcch_detector_fixed::scan(const complex16 *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos)
+{
+	unsigned int len = 0, n, e_count, i, l_count, y_offset = 0, y_len, limit, found = 0;
+	unsigned long long sum = 0;
+	float loff = 0, pm;
+	typed_circular_buffer<complex16>::view x;
+	typed_circular_buffer<unsigned int>::view e;
+	unsigned long long t = profile_start();
+
+	// calculate the error for each sample
+	while(len < s_len)
+	{
+		len += m_x_cb->write(s + len, s_len - len);
+		x = m_x_cb->readable();
+		e = m_e_cb->writable();
+		for(n = 0; (n + m_w_len + m_D <= x.len) && (n < e.len); n++)
+		{
+			e.data[n] = norm_error(x.data + n);
+			sum += e.data[n];
+		}
+		m_x_cb->consume(n);
+		m_e_cb->commit(n);
+		if(!e.len)
+			break;
+	}
+	profile_stop(PROF_ERROR, t, len);
+	if(consumed)
+		*consumed = len;
+
+	e = m_e_cb->readable();
+	e_count = e.len;
+	limit = e_count? (unsigned int)(sum / e_count * 7 / 10) : 0;
+
+	if(g_debug)
+		printf("debug: error limit: %.1lf\n", limit / 65536.0);
+
+	// find neighborhoods where the error is smaller than the limit
+	low_to_high_init();
+	for(i = 0; i < e_count; i++)
+	{
+		l_count = low_to_high(e.data[i], limit);
+		if(l_count < m_min_fb_len)
+			continue;
+
+		// see if p/m indicates a pure tone
+		y_offset = i - l_count;
+		y_len = (l_count < m_fcch_burst_len)? l_count : m_fcch_burst_len;
+		loff = freq_detect(s + y_offset, y_len, &pm);
+		if(snr)
+			*snr = pm;
+		if(g_debug)
+			printf("debug: %u\t%f\t%f\n", l_count, pm, loff);
+		if(pm > MIN_PM)
+		{
+			found = 1;
+			break;
+		}
+	}
+
+	// empty buffers for next call
+	m_e_cb->flush();
+	m_x_cb->flush();
+
+	if(!found)
+		return 0;
+
+	if(offset)
+		*offset = loff;
+
+	if(burst_pos)
+		*burst_pos = y_offset;
+
+	return 1;
+}
+
+
+/*
+ * In place radix 2 FFT of m_fft.  The data grows by at most FFT_BITS bits, so
+ * inputs below 2**14 don't overflow.
+ */
+void fcch_detector_fixed::fft()
+{
+	unsigned int i, j, k, m, half, step;
+	int t, tr, ti, wr, wi, *a, *b;
+
+	// bit reversed order
+	for(i = 0, j = 0; i < FFT_SIZE; i++)
+	{
+		if(i < j)
+		{
+			t = m_fft[2 * i]; m_fft[2 * i] = m_fft[2 * j]; m_fft[2 * j] = t;
+			t = m_fft[2 * i + 1]; m_fft[2 * i + 1] = m_fft[2 * j + 1]; m_fft[2 * j + 1] = t;
+		}
+		for(m = FFT_SIZE >> 1; m && (j & m); m >>= 1)
+			j ^= m;
+		j |= m;
+	}
+
+	for(half = 1, step = FFT_SIZE / 2; half < FFT_SIZE; half <<= 1, step >>= 1)
+	{
+		for(i = 0; i < FFT_SIZE; i += 2 * half)
+		{
+			for(k = 0; k < half; k++)
+			{
+				a = m_fft + 2 * (i + k);
+				b = a + 2 * half;
+				wr = m_tw[2 * k * step];
+				wi = m_tw[2 * k * step + 1];
+				tr = (int)(((long long)b[0] * wr - (long long)b[1] * wi) >> 15);
+				ti = (int)(((long long)b[0] * wi + (long long)b[1] * wr) >> 15);
+				b[0] = a[0] - tr;
+				b[1] = a[1] - ti;
+				a[0] += tr;
+				a[1] += ti;
+			}
+		}
+	}
+}
+
+
+static inline unsigned int bits(unsigned long long v)
+{
+	unsigned int n = 0;
+
+	while(v)
+	{
+		v >>= 1;
+		n++;
+	}
+	return n;
+}
+
+
+/*
+ * The frequency of the strongest FFT bin, refined with a parabola through the
+ * powers of it and its neighbours, and the peak to mean ratio.
+ */
+float fcch_detector_fixed::freq_detect(const complex16 *s, const unsigned int s_len, float *pm)
+{
+	unsigned int i, len, max_i = 0, sh, m = 1;
+	unsigned long long p, max = 0, sum = 0, p0, p1, p2, t = profile_start(), tp;
+	long long num, den, d = 0;
+
+	len = (s_len < FFT_SIZE)? s_len : FFT_SIZE;
+
+	// scale the input to 14 bits
+	for(i = 0; i < len; i++)
+		m |= (unsigned int)abs(s[i].re) | (unsigned int)abs(s[i].im);
+	if(bits(m) <= 14)
+	{
+		sh = 14 - bits(m);
+		for(i = 0; i < len; i++)
+		{
+			m_fft[2 * i] = s[i].re << sh;
+			m_fft[2 * i + 1] = s[i].im << sh;
+		}
+	}
+	else
+	{
+		sh = bits(m) - 14;
+		for(i = 0; i < len; i++)
+		{
+			m_fft[2 * i] = s[i].re >> sh;
+			m_fft[2 * i + 1] = s[i].im >> sh;
+		}
+	}
+	memset(m_fft + 2 * len, 0, sizeof(int) * 2 * (FFT_SIZE - len));
+
+	fft();
+
+	tp = profile_start();
+	for(i = 0; i < FFT_SIZE; i++)
+	{
+		p = (long long)m_fft[2 * i] * m_fft[2 * i] +
+		   (long long)m_fft[2 * i + 1] * m_fft[2 * i + 1];
+		sum += p;
+		if(p > max)
+		{
+			max = p;
+			max_i = i;
+		}
+	}
+
+	if(pm)
+		*pm = (sum > max)? (float)((max * (FFT_SIZE - 1)) / ((sum - max) | 1)) : 0.0;
+
+	// parabolic interpolation, scaled so that the differences fit
+	p0 = max_i? max_i - 1 : 0;
+	p2 = (max_i + 1 < FFT_SIZE)? max_i + 1 : FFT_SIZE - 1;
+	p0 = (long long)m_fft[2 * p0] * m_fft[2 * p0] + (long long)m_fft[2 * p0 + 1] * m_fft[2 * p0 + 1];
+	p2 = (long long)m_fft[2 * p2] * m_fft[2 * p2] + (long long)m_fft[2 * p2 + 1] * m_fft[2 * p2 + 1];
+	p1 = max;
+	sh = (bits(p1) > 40)? bits(p1) - 40 : 0;
+	p0 >>= sh;
+	p1 >>= sh;
+	p2 >>= sh;
+	num = ((long long)p0 - (long long)p2) << 15;
+	den = (long long)p0 - 2 * (long long)p1 + (long long)p2;
+	if(den)
+		d = num / den;
+	profile_stop(PROF_PEAK_DETECT, tp, FFT_SIZE);
+	profile_stop(PROF_FREQ_DETECT, t, len);
+
+	// Q16 bin index to Hz
+	return (float)(((long long)max_i << 16) + d) * (m_sample_rate / FFT_SIZE / 65536.0);
+}
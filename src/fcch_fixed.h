@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * fcch_detector_fixed
+ *
+ *	The FCCH detector of fcch_detector in integer arithmetic, for processors
+ *	without a (fast) FPU.  Samples are 16-bit I/Q straight from the
+ *	decimator.  The adaptive filter uses Q14 taps for the SIMD dot product
+ *	and keeps them in Q28 for the updates, the error signal is a Q16 ratio,
+ *	and the FFT has 32-bit data and Q15 twiddles.  Only the frequency of a
+ *	found burst is returned as a float.
+ */
+
+#pragma once
+
+#include "circular_buffer.h"
+#include "usrp_complex.h"
+#include "fcch_detector.h"
+
+class fcch_detector_fixed {
+
+public:
+	fcch_detector_fixed(const float sample_rate, const unsigned int D = 8);
+	~fcch_detector_fixed();
+	unsigned int scan(const complex16 *s, const unsigned int s_len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos = 0);
+	float freq_detect(const complex16 *s, const unsigned int s_len, float *pm);
+
+private:
+	// taps rounded up to whole SIMD vectors, the rest are zero
+#define W16_LEN 20
+
+	void low_to_high_init();
+	unsigned int low_to_high(unsigned int e, unsigned int a);
+	unsigned int norm_error(const complex16 *x);
+	void pack_taps();
+	void fft();
+
+	unsigned int	m_w_len,
+			m_D,
+			m_count,
+			m_block_s,
+			m_fcch_burst_len,
+			m_min_fb_len;
+	float		m_sample_rate;
+
+	int		m_w[2 * W16_LEN];	// Q28, tap w_len - 1 - j at j
+	short		m_wa[2 * W16_LEN],	// Q14 (wr, wi) for the real part
+			m_wb[2 * W16_LEN];	// Q14 (-wi, wr) for the imaginary part
+	unsigned long long	m_Eg,		// energy the step size is set for
+				m_g;		// 2**62 / m_Eg
+	long long	m_e;			// error power
+
+	typed_circular_buffer<complex16>	*m_x_cb;
+	typed_circular_buffer<unsigned int>	*m_e_cb;
+
+	int		*m_fft;			// FFT_SIZE (re, im) pairs
+	short		*m_tw;			// FFT_SIZE / 2 Q15 (cos, -sin) pairs
+};
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+
+#include "gsm_gen.h"
+
+#define SYMBOL_RATE	(GEN_RATE / SPS)
+#define BT		0.3
+#define FRAME_QUARTERS	(8 * 625)	// a TDMA frame is 8 slots of 156.25 symbols
+#define BURST_LEN	148
+
+static const char normal_tsc[] = "00100101110000100010010111";
+static const char sch_tsc[] =
+   "1011100101100010000001000000111100101101010001010111011000011011";
+
+
+gsm_gen::gsm_gen(const double sample_rate, const double offset, const unsigned int seed)
+{
+	unsigned int i;
+	double t, k, sum = 0.0;
+
+	m_decimation = (unsigned int)floor(GEN_RATE / sample_rate + 0.5);
+	if(!m_decimation)
+		m_decimation = 1;
+	m_sample_rate = GEN_RATE / m_decimation;
+	m_w = 2.0 * M_PI * offset / GEN_RATE;
+	m_phase = 0.0;
+	m_amplitude = 0.5;
+	m_sigma = 0.0;
+	m_dc_i = m_dc_q = 0.0;
+	m_iq_gain = 1.0;
+	m_iq_phase = 0.0;
+	m_carrier = 1;
+	m_last_bit = 0;
+	m_n = 0;
+	m_rng = 0x9e3779b97f4a7c15ULL * (seed + 1);
+
+	/*
+	 * The GMSK frequency pulse, a rectangle of one symbol through a
+	 * Gaussian filter, sampled over PULSE_SYMBOLS symbols.  Each symbol
+	 * turns the phase by pi / 2 in all.
+	 */
+	k = 2.0 * M_PI * BT / sqrt(log(2.0));
+	for(i = 0; i < SPS * PULSE_SYMBOLS; i++)
+	{
+		t = ((i + 0.5) / SPS - PULSE_SYMBOLS / 2.0);
+		m_pulse[i] = erfc(-k * (t + 0.5) / sqrt(2.0)) - erfc(-k * (t - 0.5) / sqrt(2.0));
+		sum += m_pulse[i];
+	}
+	for(i = 0; i < SPS * PULSE_SYMBOLS; i++)
+		m_pulse[i] *= (M_PI / 2.0) / sum;
+	for(i = 0; i < PULSE_SYMBOLS; i++)
+		m_a[i] = 1;
+}
+
+
+/*
+ * Without the carrier, only the noise and the impairments are left, e.g.,
+ * for false alarms.  The noise keeps its level.
+ */
+void gsm_gen::set_carrier(const int on)
+{
+	m_carrier = on;
+}
+
+
+// amplitude of the carrier, full scale is 1
+void gsm_gen::set_amplitude(const double a)
+{
+	double snr = m_sigma? m_amplitude * m_amplitude / (2.0 * m_sigma * m_sigma) : 0.0;
+
+	m_amplitude = a;
+	if(snr)
+		m_sigma = m_amplitude / sqrt(2.0 * snr);
+}
+
+
+// carrier to noise ratio in the output bandwidth
+void gsm_gen::set_snr(const double snr_db)
+{
+	m_sigma = m_amplitude / sqrt(2.0 * pow(10.0, snr_db / 10.0));
+}
+
+
+// DC offset of each component, full scale is 1
+void gsm_gen::set_dc(const double i, const double q)
+{
+	m_dc_i = i;
+	m_dc_q = q;
+}
+
+
+/*
+ * The Q branch has gain_db more gain than the I branch and is phase_deg
+ * away from quadrature.
+ */
+void gsm_gen::set_iq_imbalance(const double gain_db, const double phase_deg)
+{
+	m_iq_gain = pow(10.0, gain_db / 20.0);
+	m_iq_phase = phase_deg * M_PI / 180.0;
+}
+
+
+double gsm_gen::sample_rate()
+{
+	return m_sample_rate;
+}
+
+
+// xorshift64*, in [0, 1)
+double gsm_gen::uniform()
+{
+	m_rng ^= m_rng >> 12;
+	m_rng ^= m_rng << 25;
+	m_rng ^= m_rng >> 27;
+	return ((m_rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+double gsm_gen::gaussian()
+{
+	double u = uniform();
+
+	if(u < 1e-300)
+		u = 1e-300;
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * uniform());
+}
+
+
+/*
+ * The bit of the symbol now starting.  Slots are 156 or 157 symbols long so
+ * that 8 of them make 1250.
+ */
+unsigned int gsm_gen::next_bit()
+{
+	unsigned long long s = m_n / SPS;
+	unsigned int frame, q, slot, pos;
+
+	frame = (unsigned int)((s * 4 / FRAME_QUARTERS) % 51);
+	q = (unsigned int)(s * 4 % FRAME_QUARTERS);
+	slot = q / 625;
+	pos = (q - slot * 625) / 4;
+
+	if(slot || (pos >= BURST_LEN))
+		return uniform() < 0.5;
+
+	// tail bits
+	if((pos < 3) || (pos >= BURST_LEN - 3))
+		return 0;
+
+	// FCCH
+	if((frame % 10 == 0) && (frame != 50))
+		return 0;
+
+	// SCH
+	if(frame % 10 == 1)
+	{
+		if((pos >= 42) && (pos < 42 + 64))
+			return sch_tsc[pos - 42] - '0';
+		return uniform() < 0.5;
+	}
+
+	// normal burst
+	if((pos >= 61) && (pos < 61 + 26))
+		return normal_tsc[pos - 61] - '0';
+	return uniform() < 0.5;
+}
+
+
+// the next sample at GEN_RATE, without impairments
+complex gsm_gen::next()
+{
+	unsigned int i, r = m_n % SPS, b;
+	double f = 0.0;
+
+	if(!r)
+	{
+		b = next_bit();
+		for(i = PULSE_SYMBOLS - 1; i > 0; i--)
+			m_a[i] = m_a[i - 1];
+		m_a[0] = (b ^ m_last_bit)? -1 : 1;
+		m_last_bit = b;
+	}
+	for(i = 0; i < PULSE_SYMBOLS; i++)
+		f += m_a[i] * m_pulse[r + i * SPS];
+	m_phase = fmod(m_phase + f + m_w, 2.0 * M_PI);
+	m_n++;
+	return complex(cos(m_phase), sin(m_phase));
+}
+
+
+/*
+ * Generate len samples at sample_rate().  Returns len.
+ */
+unsigned int gsm_gen::generate(complex *out, const unsigned int len)
+{
+	unsigned int i, j;
+	double re, im, s = m_amplitude / m_decimation, c = cos(m_iq_phase), sn = sin(m_iq_phase);
+	complex x;
+
+	for(i = 0; i < len; i++)
+	{
+		x = 0.0;
+		for(j = 0; j < m_decimation; j++)
+			x += next();
+		if(!m_carrier)
+			x = 0.0;
+		re = x.real() * s;
+		im = x.imag() * s;
+		if(m_sigma)
+		{
+			re += m_sigma * gaussian();
+			im += m_sigma * gaussian();
+		}
+		im = m_iq_gain * (im * c + re * sn);
+		out[i] = complex(re + m_dc_i, im + m_dc_q);
+	}
+	return len;
+}
+
+
+/*
+ * Generate len samples as interleaved unsigned bytes, like rtl_sdr writes
+ * them.  out must have room for 2 * len bytes.
+ */
+unsigned int gsm_gen::generate_u8(unsigned char *out, const unsigned int len)
+{
+	static const unsigned int	CHUNK = 1024;
+	complex buf[CHUNK];
+	unsigned int i, n, done;
+	long v;
+
+	for(done = 0; done < len; done += n)
+	{
+		n = (len - done < CHUNK)? len - done : CHUNK;
+		generate(buf, n);
+		for(i = 0; i < n; i++)
+		{
+			v = lrint(127.4 + buf[i].real() * 127.5);
+			*out++ = (v < 0)? 0 : (v > 255)? 255 : v;
+			v = lrint(127.4 + buf[i].imag() * 127.5);
+			*out++ = (v < 0)? 0 : (v > 255)? 255 : v;
+		}
+	}
+	return len;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * gsm_gen
+ *
+ *	A synthetic GSM C0 carrier for tests and benchmarks.  It transmits the
+ *	51-multiframe of timeslot 0, FCCH bursts in frames 0, 10, 20, 30 and 40,
+ *	SCH bursts in the frames after them and normal bursts with random data
+ *	everywhere else, GMSK modulated with BT = 0.3.  The carrier can be
+ *	offset in frequency and impaired with white noise, DC and IQ imbalance.
+ *
+ *	The modulator runs at the dongle's 1.625 MS/s.  Lower rates are box car
+ *	averaged from it, as usrp_source does, so 270.833 kS/s is a decimation
+ *	of 6.  The same seed always gives the same samples.
+ */
+
+#include "usrp_complex.h"
+
+#define GEN_RATE	(1625000.0)	// the dongle's rate
+
+class gsm_gen {
+public:
+	gsm_gen(const double sample_rate = GEN_RATE / 6, const double offset = 0.0, const unsigned int seed = 1);
+
+	void set_carrier(const int on);
+	void set_amplitude(const double a);
+	void set_snr(const double snr_db);
+	void set_dc(const double i, const double q);
+	void set_iq_imbalance(const double gain_db, const double phase_deg);
+
+	unsigned int generate(complex *out, const unsigned int len);
+	unsigned int generate_u8(unsigned char *out, const unsigned int len);
+	double sample_rate();
+
+private:
+	complex next();
+	unsigned int next_bit();
+	double uniform();
+	double gaussian();
+
+	static const unsigned int	SPS = 6;		// at GEN_RATE
+	static const unsigned int	PULSE_SYMBOLS = 3;
+
+	unsigned int		m_decimation;
+	double			m_sample_rate,
+				m_w,			// offset, radians per sample
+				m_phase,
+				m_amplitude,
+				m_sigma,		// noise per component
+				m_dc_i,
+				m_dc_q,
+				m_iq_gain,
+				m_iq_phase;
+	double			m_pulse[SPS * PULSE_SYMBOLS];
+	int			m_a[PULSE_SYMBOLS];	// last symbols, newest first
+	unsigned int		m_carrier,
+				m_last_bit;
+	unsigned long long	m_n,			// samples at GEN_RATE
+				m_rng;
+};
@@ -47,8 +47,10 @@
 #ifndef _WIN32
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #endif
 #include <string.h>
+#include <math.h>
 
 #include <errno.h>
 
@@ -56,14 +58,270 @@
 #include "arfcn_freq.h"
 #include "offset.h"
 #include "c0_detect.h"
+#include "fcch_detector.h"
+#include "multi_offset.h"
+#include "kal_daemon.h"
+#include "kal_shm.h"
+#include "scan_cache.h"
+#include "profile.h"
+#include "util.h"
 #include "version.h"
-#ifdef _WIN32
 #include <getopt.h>
+
+
+extern int g_verbosity;
+extern int g_debug;
+extern int g_low_memory;
+extern int g_prescan;
+
+/*
+ * Carriers calibrated at once must fit in the device bandwidth, leaving
+ * room for their own.
+ */
+static const unsigned int	MULTI_MAX	= 8;
+static const double		MULTI_SPAN	= 1.2e6;
+
+// a quick scan still scans the band when its cache is older, in seconds
+static const double		CACHE_MAX_AGE	= 24 * 3600;
+
+// long options without a short one
+enum {
+	OPT_PROFILE = 256,
+	OPT_DAEMON,
+	OPT_SHM,
+	OPT_QUICK,
+	OPT_NO_PRESCAN,
+	OPT_VSS
+};
+
+static struct option long_options[] = {
+	{"profile",	optional_argument,	0,	OPT_PROFILE},
+	{"daemon",	optional_argument,	0,	OPT_DAEMON},
+	{"shm",		optional_argument,	0,	OPT_SHM},
+	{"quick",	no_argument,		0,	OPT_QUICK},
+	{"no-prescan",	no_argument,		0,	OPT_NO_PRESCAN},
+	{"vss",		no_argument,		0,	OPT_VSS},
+	{0,		0,			0,	0}
+};
+
+/*
+ * A quick scan runs twice over some channels, first over the cached ones and
+ * then over the band.  Each is shown once and the band is authoritative.
+ */
+struct scan_summary
+{
+	kal_channel	chans[C0_MAX_CHANS];	// with a burst
+	unsigned int	found;
+};
+
+
+static void print_channel(const kal_channel *c, void *arg)
+{
+	scan_summary *s = (scan_summary *)arg;
+	unsigned int i;
+
+	// DCS and PCS share channel numbers
+	for(i = 0; (i < s->found) && (s->chans[i].freq != c->freq); i++)
+		;
+
+	if(c->found)
+	{
+		s->chans[i] = *c;
+		if(i < s->found)
+			return;
+		s->found++;
+		printf("    chan: %4d (%.1fMHz ", c->chan, c->freq / 1e6);
+		display_freq(c->offset);
+		printf(")    power: %5.0f \ttuner gain: %ddB \tsnr: %.0f\n", c->power, c->tuner_gain, c->snr);
+		return;
+	}
+
+	// gone since it was cached
+	if(i < s->found)
+		s->chans[i] = s->chans[--s->found];
+
+	if(g_verbosity > 0)
+	{
+		printf("    chan: %4d (%.1fMHz):\tpower: %5.0f \ttuner gain: %ddB \tsnr: %.0f\n",
+		   c->chan, c->freq / 1e6, c->power, c->tuner_gain, c->snr);
+	}
+	else if(isatty(1))
+	{
+		printf("...chan %4i\r", c->chan);
+		fflush(stdout);
+	}
+}
+
+
+static void print_scan(const scan_summary *s)
+{
+	float min_offset = 0.0, max_offset = 0.0, spread = 0.0;
+	unsigned int i, j, n;
+
+	printf("%d base stations found !\n", s->found);
+
+	if (s->found == 1)
+	{
+		printf("\n");
+		printf("Only one channel was found. This is unlikely and may "
+			"indicate you need to provide a rough estimate of the initial "
+			"PPM. It can be provided with the '-e' option. Try tuning against "
+			"a local FM radio or other known frequency first.\n");
+	}
+
+	// per band, the offset grows with the frequency
+	for(j = 0; j < s->found; j++)
+	{
+		for(i = n = 0; i < s->found; i++)
+		{
+			if(s->chans[i].band != s->chans[j].band)
+				continue;
+			if(!n || (s->chans[i].offset < min_offset))
+				min_offset = s->chans[i].offset;
+			if(!n || (s->chans[i].offset > max_offset))
+				max_offset = s->chans[i].offset;
+			n++;
+		}
+		if(max_offset - min_offset > spread)
+			spread = max_offset - min_offset;
+	}
+
+	/*
+	 * If the difference in offsets found is strangely large
+	 */
+	if (s->found > 1 && spread > 1000)
+	{
+		printf("\n");
+		printf("Difference of offsets between channels is >1kHz. This likely "
+			"means that the correct PPM is too far away and you need to provide "
+			"a rough estimate using the '-e' option. Try tuning against "
+			"a local FM radio or other known frequency first.\n");
+	}
+}
+
+
+/*
+ * The FCCH search of the channels the pre-scan dropped would have taken as
+ * long as that of the others.
+ */
+static void print_prescan(const c0_stats *st)
+{
+	printf("pre-scan: %u of %u channels above the noise floor, %.1fs",
+	   st->checked, st->chans, st->prescan_s + st->detect_s);
+	if(st->checked)
+		printf(" instead of about %.1fs", st->detect_s * st->chans / st->checked);
+	printf("\n");
+}
+
+
+/*
+ * With quick, first look at the channels found last time, strongest first.
+ * Then scan the whole bands, at a lower priority, if a cache is missing, old
+ * or some of its channels are gone, and cache what it finds, per band.  The
+ * cache is only written after a sweep, its age is that of the last one.  Both
+ * use the same detector, the band scan starts the cached channels from the
+ * filter state the first look left.
+ */
+static int scan(usrp_source *u, const int *bands, int nb, int quick, int step)
+{
+	scan_summary *s = new scan_summary;
+	kal_channel *cached = new kal_channel[C0_MAX_CHANS];
+	fcch_detector *l = new fcch_detector(u->sample_rate());
+	int r = 0, chans[C0_MAX_CHANS];
+	char path[BI_MAX][1024];
+	unsigned int i, k, m;
+	double age, max_age = 0.0;
+	c0_stats st;
+	int b, n, total = 0, missing = 0, swept = 0;
+
+	l->set_step_size(step);
+	memset(s, 0, sizeof(*s));
+	for(b = 0; b < nb; b++)
+	{
+		if(scan_cache_path(path[b], sizeof(path[b]), bands[b], u->serial()))
+		{
+			fprintf(stderr, "warning: no scan cache\n");
+			path[b][0] = 0;
+		}
+
+		if(!quick || (r < 0))
+			continue;
+		age = 0.0;
+		if(!path[b][0] || ((n = scan_cache_load(path[b], cached, C0_MAX_CHANS, &age)) <= 0))
+		{
+			missing = 1;
+			continue;
+		}
+		if(age > max_age)
+			max_age = age;
+		scan_cache_sort(cached, n);
+		for(i = 0; i < (unsigned int)n; i++)
+			chans[i] = cached[i].chan;
+		printf("Checking %d cached %s channels\n", n, bi_to_str(bands[b]));
+		if((r = c0_detect_chans(u, bands[b], chans, n, print_channel, s, l)) >= 0)
+		{
+			missing |= (r < n);
+			total += n;
+		}
+	}
+
+	if((r >= 0) && (!quick || missing || (max_age > CACHE_MAX_AGE)))
+	{
+		if(quick)
+		{
+			printf("Scanning the band%s\n", (nb > 1)? "s" : "");
+#ifndef _WIN32
+			setpriority(PRIO_PROCESS, 0, 10);
 #endif
+		}
+		r = c0_detect_bands(u, bands, nb, print_channel, s, l, &st);
+		swept = 1;
+		if((r >= 0) && g_prescan)
+			print_prescan(&st);
+	}
+	else if(r >= 0)
+		printf("The %d cached channels are all there, not scanning\n", total);
+
+	if(r >= 0)
+	{
+		print_scan(s);
+		for(b = 0; swept && (b < nb); b++)
+		{
+			if(!path[b][0])
+				continue;
+			for(k = m = 0; k < s->found; k++)
+			{
+				if(s->chans[k].band == bands[b])
+					cached[m++] = s->chans[k];
+			}
+			if(scan_cache_save(path[b], cached, m))
+				fprintf(stderr, "warning: could not write %s\n", path[b]);
+		}
+		r = 0;
+	}
+	delete l;
+	delete[] cached;
+	delete s;
+	return r;
+}
+
 
+static void print_calibration(const kal_calibration *r, int track, float tolerance)
+{
+	printf("average\t\t[min, max]\t(range, stddev)\n");
+	display_freq(r->offset);
+	printf("\t\t[%d, %d]\t(%d, %.2f)\n", (int)round(r->min), (int)round(r->max),
+	   (int)round(r->max - r->min), r->stddev);
+	printf("overruns: %u\n", r->overruns);
+	printf("not found: %u\n", r->notfound);
+	if(track)
+		printf("tracking misses: %u\n", r->misses);
+	printf("average absolute error: %.2f ppm\n", r->ppm);
+	if(tolerance > 0.0)
+		printf("bursts: %u \t95%% confidence: +/- %.3f ppm\n", r->bursts, r->ci);
+	printf("tuner gain: %ddB \tsnr: %.0f\n", r->tuner_gain, r->snr);
+}
 
-int g_verbosity = 0;
-int g_debug = 0;
 
 void usage(char *prog)
 {
@@ -77,20 +335,33 @@ void usage(char *prog)
 	printf("\t\t%s <-f frequency | -c channel> [options]\n", prog);
 	printf("\n");
 	printf("Where options are:\n");
-	printf("\t-s\tband to scan (GSM850, GSM-R, GSM900, EGSM, DCS, PCS)\n");
+	printf("\t-s\tbands to scan (GSM850, GSM-R, GSM900, EGSM, DCS, PCS), e.g., GSM900,DCS, or all\n");
 	printf("\t-b\tband indicator (GSM850, GSM-R, GSM900, EGSM, DCS, PCS)\n");
 	printf("\t-f\tfrequency of nearby GSM base station\n");
 	printf("\t-c\tchannel of nearby GSM base station\n");
+	printf("\t-M\tcomma separated channels to calibrate against at once\n");
 	printf("\t-g\tgain in dB (default: 0 for auto)\n");
 #if HAVE_DITHERING == 1
 	printf("\t-N\tdisable dithering (default: dithering enabled)\n");
 #endif
 	printf("\t-d\tdevice index\n");
+	printf("\t-F\tread samples from an rtl_sdr file recorded at 1.625 MS/s\n");
 	printf("\t-e\tinitial frequency error in ppm\n");
 	printf("\t-w\ttuner bandwidth in Hz\n");
 	printf("\t-E\tmanual frequency offset in hz\n");
+	printf("\t-T\ttrack FCCH bursts once found (offset calculation)\n");
+	printf("\t-a\tstop once the offset is known to this many ppm (offset calculation)\n");
+	printf("\t-C\tkeep tracking the offset, reporting every this many seconds\n");
+	printf("\t-L\tlow memory, size buffers to what one search needs\n");
+	printf("\t-X\tfixed point detection (offset calculation)\n");
 	printf("\t-v\tverbose\n");
 	printf("\t-D\tenable debug messages\n");
+	printf("\t--quick\tcheck the channels the last scan found first (band scan)\n");
+	printf("\t--no-prescan\n\t\tsearch every channel for FCCH bursts, not only those above the noise (band scan)\n");
+	printf("\t--vss\tvariable step size for the FCCH filter, see kal_roc -m\n");
+	printf("\t--profile[=json]\n\t\treport where the time went when done\n");
+	printf("\t--daemon[=socket]\n\t\tserve calibrate and scan requests on a Unix socket (default: %s)\n", DAEMON_SOCKET);
+	printf("\t--shm[=name]\n\t\tpublish the ppm estimate in POSIX shared memory (default: %s)\n", KAL_SHM_NAME);
 	printf("\t-h\thelp\n");
 	exit(-1);
 }
@@ -98,19 +369,29 @@ void usage(char *prog)
 
 int main(int argc, char **argv)
 {
-	int c, bi = BI_NOT_DEFINED, chan = -1, bts_scan = 0;
-	int ppm_error = 0, hz_adjust = 0;
+	int c, profile = PROFILE_OFF, bi = BI_NOT_DEFINED, chan = -1, bts_scan = 0;
+	int ppm_error = 0, hz_adjust = 0, track = 0, fixed_point = 0, quick = 0, step = LMS_FIXED;
+	int bands[BI_MAX];
 	int bandwidth = 200000;
 	int dithering = true;
 	unsigned int device = 0;
 	int gain = 0;
 	double freq = -1.0;
+	float tolerance = 0.0, interval = 0.0;
+	int multi_chans[MULTI_MAX];
+	double multi_freqs[MULTI_MAX], multi_min = 0.0, multi_max = 0.0;
+	unsigned int i, multi = 0;
+	char *tok, *infile = 0;
+	const char *daemon_socket = 0, *shm_name = 0;
 	usrp_source *u;
+	fcch_detector *l = 0;
+	kal_options o;
+	kal_calibration cal;
 	int r;
 
 	if(!strcmp("miri_kal", argv[0]))
 		gain = 70;
-	while((c = getopt(argc, argv, "f:b:c:s:g:e:w:E:Nd:vDh?")) != EOF)
+	while((c = getopt_long(argc, argv, "f:b:c:M:s:g:e:w:E:Ta:C:Nd:F:LXvDh?", long_options, 0)) != EOF)
 	{
 		switch(c)
 		{
@@ -122,13 +403,25 @@ int main(int argc, char **argv)
 				chan = strtoul(optarg, 0, 0);
 				break;
 
+			case 'M':
+				for(tok = strtok(optarg, ","); tok; tok = strtok(0, ","))
+				{
+					if(multi == MULTI_MAX)
+					{
+						fprintf(stderr, "Error: at most %u channels\n\n", MULTI_MAX);
+						usage(argv[0]);
+					}
+					multi_chans[multi++] = strtoul(tok, 0, 0);
+				}
+				break;
+
 			case 's':
-				if((bi = str_to_bi(optarg)) == -1)
+				if((bts_scan = str_to_bands(optarg, bands, BI_MAX)) == -1)
 				{
 					fprintf(stderr, "Error: invalid band indicator: '%s'\n\n", optarg);
 					usage(argv[0]);
 				}
-				bts_scan = 1;
+				bi = bands[0];
 				break;
 
 			case 'b':
@@ -155,6 +448,22 @@ int main(int argc, char **argv)
 				dithering = false;
 				break;
 
+			case 'T':
+				track = 1;
+				break;
+
+			case 'a':
+				tolerance = strtod(optarg, 0);
+				break;
+
+			case 'C':
+				if((interval = strtod(optarg, 0)) <= 0.0)
+				{
+					fprintf(stderr, "Error: invalid interval: '%s'\n\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+
 			case 'E':
 				hz_adjust = strtol(optarg, 0, 0);
 				break;
@@ -163,6 +472,18 @@ int main(int argc, char **argv)
 				device = strtol(optarg, 0, 0);
 				break;
 
+			case 'F':
+				infile = optarg;
+				break;
+
+			case 'L':
+				g_low_memory = 1;
+				break;
+
+			case 'X':
+				fixed_point = 1;
+				break;
+
 			case 'v':
 				g_verbosity++;
 				break;
@@ -171,6 +492,38 @@ int main(int argc, char **argv)
 				g_debug = 1;
 				break;
 
+			case OPT_PROFILE:
+				if(!optarg || !strcmp(optarg, "text"))
+					profile = PROFILE_TEXT;
+				else if(!strcmp(optarg, "json"))
+					profile = PROFILE_JSON;
+				else
+				{
+					fprintf(stderr, "Error: invalid profile format: '%s'\n\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+
+			case OPT_DAEMON:
+				daemon_socket = optarg? optarg : DAEMON_SOCKET;
+				break;
+
+			case OPT_NO_PRESCAN:
+				g_prescan = 0;
+				break;
+
+			case OPT_QUICK:
+				quick = 1;
+				break;
+
+			case OPT_VSS:
+				step = LMS_VSS;
+				break;
+
+			case OPT_SHM:
+				shm_name = optarg? optarg : KAL_SHM_NAME;
+				break;
+
 			case 'h':
 			case '?':
 			default:
@@ -179,6 +532,25 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if(shm_name && kal_shm_open(shm_name))
+	{
+		fprintf(stderr, "error: kal_shm_open\n");
+		return -1;
+	}
+
+	if(daemon_socket)
+	{
+		kal_default_options(&o);
+		o.device = device;
+		o.file = infile;
+		o.gain = gain;
+		o.dithering = dithering;
+		o.ppm_error = ppm_error;
+		o.bandwidth = bandwidth;
+		o.hz_adjust = hz_adjust;
+		return kal_daemon(daemon_socket, &o);
+	}
+
 	// sanity check frequency / channel
 	if(bts_scan)
 	{
@@ -188,6 +560,32 @@ int main(int argc, char **argv)
 			usage(argv[0]);
 		}
 	}
+	else if(multi)
+	{
+		for(i = 0; i < multi; i++)
+		{
+			int mbi = bi;
+
+			multi_freqs[i] = arfcn_to_freq(multi_chans[i], &mbi);
+			if(multi_freqs[i] < 869e6)
+			{
+				fprintf(stderr, "error: bad channel: %d\n", multi_chans[i]);
+				usage(argv[0]);
+			}
+			if(!i || (multi_freqs[i] < multi_min))
+				multi_min = multi_freqs[i];
+			if(!i || (multi_freqs[i] > multi_max))
+				multi_max = multi_freqs[i];
+		}
+		if(multi_max - multi_min > MULTI_SPAN)
+		{
+			fprintf(stderr, "error: channels must be within %.1fMHz\n", MULTI_SPAN / 1e6);
+			usage(argv[0]);
+		}
+		freq = (multi_min + multi_max) / 2.0;
+		if(bandwidth < multi_max - multi_min + 200000)
+			bandwidth = multi_max - multi_min + 200000;
+	}
 	else
 	{
 		if(freq < 0.0)
@@ -215,6 +613,9 @@ int main(int argc, char **argv)
 		printf("debug: Gain          :\t%d\n", gain);
 	}
 
+	if(profile)
+		profile_init(profile);
+
 	u = new usrp_source();
 	if(!u)
 	{
@@ -222,7 +623,30 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	if(u->open(device) == -1)
+	if(fixed_point)
+	{
+		if(bts_scan || multi)
+		{
+			fprintf(stderr, "error: fixed point detection only works with a single channel\n");
+			usage(argv[0]);
+		}
+		if(step != LMS_FIXED)
+		{
+			fprintf(stderr, "error: fixed point detection only has the fixed step size\n");
+			usage(argv[0]);
+		}
+		u->set_fixed_point(1);
+	}
+
+	if(infile)
+	{
+		if(u->open_file(infile) == -1)
+		{
+			fprintf(stderr, "error: usrp_source::open_file\n");
+			return -1;
+		}
+	}
+	else if(u->open(device) == -1)
 	{
 		fprintf(stderr, "error: usrp_source::open\n");
 		return -1;
@@ -261,7 +685,23 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	if(!bts_scan)
+	if(multi)
+	{
+		u->set_decimation(1);
+		if(!u->tune(freq + hz_adjust))
+		{
+			fprintf(stderr, "error: usrp_source::tune\n");
+			return -1;
+		}
+
+		printf("%s: Calculating clock frequency offset.\n", argv[0]);
+		printf("Using %u channels around %.1fMHz\n", multi, freq / 1e6);
+		printf("Tuned to %.6fMHz (reported tuner error: %.0fHz)\n",
+		   u->m_center_freq / 1e6, u->m_center_freq - freq);
+
+		r = multi_offset_detect(u, multi_chans, multi_freqs, multi, step);
+	}
+	else if(!bts_scan)
 	{
 		if(!u->tune(freq+hz_adjust))
 		{
@@ -277,14 +717,33 @@ int main(int argc, char **argv)
 		printf("Tuned to %.6fMHz (reported tuner error: %.0fHz)\n",
 		   u->m_center_freq / 1e6, tuner_error);
 
-		r = offset_detect(u, hz_adjust, tuner_error);
+		// the offset code makes its own detector unless told otherwise
+		if(step != LMS_FIXED)
+		{
+			l = new fcch_detector(u->sample_rate());
+			l->set_step_size(step);
+		}
+
+		profile_channel(chan);
+		if(interval > 0.0)
+			r = offset_track(u, hz_adjust, tuner_error, interval, l);
+		else if(!(r = offset_detect(u, hz_adjust, tuner_error, &cal, track, tolerance, l)))
+		{
+			print_calibration(&cal, track, tolerance);
+			kal_shm_publish(chan, freq, cal.ppm, cal.ppm_stddev, 0.0, cal.bursts);
+		}
+		delete l;
 	}
 	else
 	{
-		printf("%s: Scanning for %s base stations.\n",
-		argv[0], bi_to_str(bi));
-		r = c0_detect(u, bi);
+		printf("%s: Scanning for ", argv[0]);
+		for(i = 0; i < (unsigned int)bts_scan; i++)
+			printf("%s%s", i? ", " : "", bi_to_str(bands[i]));
+		printf(" base stations.\n");
+		r = scan(u, bands, bts_scan, quick, step);
 	}
+	kal_shm_close();
+	profile_report(stdout);
 	//delete u;
 	return r;
 }
@@ -0,0 +1,738 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * kal_bench
+ *
+ *	Micro benchmarks for the hot paths of kal.  They run on synthetic data
+ *	and don't need a device.
+ *
+ *	-o writes the results to a baseline file, one "name<TAB>ns<TAB>items/s"
+ *	line per benchmark.  -b compares against such a file and exits with 1
+ *	if any benchmark got slower by more than -t percent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "circular_buffer.h"
+#include "fcch_detector.h"
+#include "u8_converter.h"
+#include "usrp_complex.h"
+#include "util.h"
+
+int g_debug = 0;
+int g_low_memory = 0;
+int g_profile = 0;
+
+static const unsigned int	CB_LEN		= 16 * 16384;
+static const unsigned long long	CB_ITEMS	= 1ULL << 25;
+static const unsigned int	USB_CB_LEN	= 32 * 16384;	// usrp_source::CB_LEN
+static const unsigned int	SEARCHES	= 20;
+static const unsigned int	KERNEL_RUNS	= 200;
+
+
+static const unsigned int	MAX_RESULTS	= 64;
+static const double		THRESHOLD	= 20.0;	// percent
+
+struct result
+{
+	char	name[64];
+	double	ns,
+		rate;
+};
+
+static result		results[MAX_RESULTS];
+static unsigned int	n_results = 0;
+static const char	*filter = 0;
+
+
+static int selected(const char *name)
+{
+	return !filter || strstr(name, filter);
+}
+
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void report(const char *name, double secs, unsigned long long items)
+{
+	result *r;
+
+	printf("%-32s %10.2f ns/item %12.0f items/s\n", name, secs * 1e9 / items, items / secs);
+	if(n_results == MAX_RESULTS)
+		return;
+	r = &results[n_results++];
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->ns = secs * 1e9 / items;
+	r->rate = items / secs;
+}
+
+
+/*
+ * Two threads moving CB_ITEMS complex samples through a buffer in chunks,
+ * like the USB thread and the detector.
+ */
+struct cb_job
+{
+	circular_buffer	*cb;
+	unsigned int	chunk;
+};
+
+
+static void *cb_producer(void *arg)
+{
+	cb_job *j = (cb_job *)arg;
+	complex *buf = new complex[j->chunk];
+	unsigned long long done = 0;
+	unsigned int i;
+
+	for(i = 0; i < j->chunk; i++)
+		buf[i] = complex(i, -(float)i);
+	while(done < CB_ITEMS)
+		done += j->cb->write(buf, j->chunk);
+	delete[] buf;
+	return 0;
+}
+
+
+static void bench_cb_threads(const char *name, unsigned int spsc, unsigned int chunk)
+{
+	circular_buffer *cb;
+	unsigned long long done = 0;
+	unsigned int len;
+	pthread_t t;
+	cb_job j;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	cb = new circular_buffer(CB_LEN, sizeof(complex), 0, spsc);
+	j.cb = cb;
+	j.chunk = chunk;
+	start = now();
+	pthread_create(&t, 0, cb_producer, &j);
+	while(done < CB_ITEMS)
+	{
+		cb->peek(&len);
+		if(len > chunk)
+			len = chunk;
+		done += cb->purge(len);
+	}
+	pthread_join(t, 0);
+	report(name, now() - start, done);
+	delete cb;
+}
+
+
+/*
+ * One thread writing, peeking and purging a sample at a time, like
+ * fcch_detector::scan.
+ */
+static void bench_cb_single(const char *name, unsigned int spsc)
+{
+	circular_buffer *cb;
+	unsigned long long i, n = CB_ITEMS / 4;
+	unsigned int len;
+	complex c(1.0, -1.0);
+	double start;
+
+	if(!selected(name))
+		return;
+
+	cb = new circular_buffer(8192, sizeof(complex), 0, spsc);
+	start = now();
+	for(i = 0; i < n; i++)
+	{
+		cb->write(&c, 1);
+		cb->peek(&len);
+		if(len > 24)
+			cb->purge(1);
+	}
+	report(name, now() - start, n);
+	delete cb;
+}
+
+
+/*
+ * Copying write() and read() of a chunk at a time, per sample.
+ */
+static void bench_cb_rw(const char *name, unsigned int chunk)
+{
+	circular_buffer *cb;
+	unsigned long long i, n = CB_ITEMS / 4;
+	complex *in, *out;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	cb = new circular_buffer(8192, sizeof(complex), 0, 1);
+	in = new complex[chunk];
+	out = new complex[chunk];
+	for(i = 0; i < chunk; i++)
+		in[i] = complex(i, -(float)i);
+	start = now();
+	for(i = 0; i < n; i += chunk)
+	{
+		cb->write(in, chunk);
+		cb->read(out, chunk);
+	}
+	report(name, now() - start, n);
+	delete[] out;
+	delete[] in;
+	delete cb;
+}
+
+
+/*
+ * How long a consumer blocked in wait_for_data() takes to notice a write.
+ */
+static const unsigned int	WAKE_COUNT	= 1000;
+
+struct wake_job
+{
+	circular_buffer	*cb;
+	double		written[WAKE_COUNT];
+};
+
+
+static void *wake_producer(void *arg)
+{
+	wake_job *j = (wake_job *)arg;
+	complex c;
+	unsigned int i;
+
+	for(i = 0; i < WAKE_COUNT; i++)
+	{
+		usleep(200);
+		j->written[i] = now();
+		j->cb->write(&c, 1);
+	}
+	return 0;
+}
+
+
+static void bench_cb_wake(const char *name, unsigned int spsc)
+{
+	wake_job *j;
+	unsigned int i;
+	pthread_t t;
+	double sum = 0;
+
+	if(!selected(name))
+		return;
+
+	j = new wake_job;
+	j->cb = new circular_buffer(8192, sizeof(complex), 0, spsc);
+	pthread_create(&t, 0, wake_producer, j);
+	for(i = 0; i < WAKE_COUNT; i++)
+	{
+		j->cb->wait_for_data(1);
+		sum += now() - j->written[i];
+		j->cb->purge(1);
+	}
+	pthread_join(t, 0);
+	report(name, sum, WAKE_COUNT);
+	delete j->cb;
+	delete j;
+}
+
+
+/*
+ * The same through a typed buffer, a batch at a time.
+ */
+static void bench_cb_typed(const char *name, unsigned int batch)
+{
+	typed_circular_buffer<complex> *cb;
+	typed_circular_buffer<complex>::view v;
+	unsigned long long i, n = CB_ITEMS / 4;
+	complex *c;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	cb = new typed_circular_buffer<complex>(8192, 0, 1);
+	c = new complex[batch];
+	for(i = 0; i < batch; i++)
+		c[i] = complex(1.0, -1.0);
+	start = now();
+	for(i = 0; i < n; i += batch)
+	{
+		cb->write(c, batch);
+		v = cb->readable();
+		if(v.len > 24)
+			cb->consume(v.len - 24);
+	}
+	report(name, now() - start, n);
+	delete[] c;
+	delete cb;
+}
+
+
+/*
+ * The USB callback's conversion of a dongle buffer, per input byte.
+ */
+static const unsigned int	USB_LEN		= 48 * 512;	// rtlsdr_read_async() buffer
+static const unsigned int	USB_BUFFERS	= 4096;
+
+static void bench_convert(const char *name, unsigned int d, int fixed)
+{
+	u8_converter *conv;
+	unsigned char *buf;
+	complex *out;
+	complex16 *out16;
+	unsigned int i;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	conv = new u8_converter;
+	buf = new unsigned char[USB_LEN];
+	out = new complex[USB_LEN / 2];
+	out16 = new complex16[USB_LEN / 2];
+	srand(1);
+	for(i = 0; i < USB_LEN; i++)
+		buf[i] = rand() & 0xff;
+	start = now();
+	for(i = 0; i < USB_BUFFERS; i++)
+	{
+		if(fixed)
+			conv->convert16(buf, USB_LEN, d, out16, USB_LEN / 2);
+		else
+			conv->convert(buf, USB_LEN, d, out, USB_LEN / 2);
+	}
+	report(name, now() - start, (unsigned long long)USB_LEN * USB_BUFFERS);
+	delete[] out16;
+	delete[] out;
+	delete[] buf;
+	delete conv;
+}
+
+
+/*
+ * A capture of 12 frames and 1 burst at the GSM rate: random symbols with an
+ * FCCH burst, 1 kHz off, in the middle.
+ */
+static complex *make_capture(unsigned int *len)
+{
+	unsigned int i, s_len, burst;
+	complex *s;
+	double ph = 0.0;
+
+	s_len = (unsigned int)ceil(12 * 8 * 156.25 + 156.25);
+	burst = s_len / 2;
+	s = new complex[s_len];
+	srand(1);
+	for(i = 0; i < s_len; i++)
+	{
+		if((i >= burst) && (i < burst + 148))
+			ph += 2.0 * M_PI * (GSM_RATE / 4.0 + 1000.0) / GSM_RATE;
+		else
+			ph += ((rand() & 1)? 0.5 : -0.5) * M_PI;
+		s[i] = complex(4096.0 * cos(ph) + (rand() % 512) - 256,
+		   4096.0 * sin(ph) + (rand() % 512) - 256);
+	}
+	*len = s_len;
+	return s;
+}
+
+
+/*
+ * The line enhancer a sample at a time, through the detector's buffers.
+ */
+static void bench_norm_error(const char *name)
+{
+	fcch_detector *l;
+	unsigned int s_len, pos, i, n = 0;
+	complex *s;
+	float e;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	s = make_capture(&s_len);
+	l = new fcch_detector(GSM_RATE);
+	start = now();
+	for(i = 0; i < KERNEL_RUNS; i++)
+	{
+		for(pos = 0; pos < s_len; )
+		{
+			pos += l->update(s + pos, s_len - pos);
+			while(!l->next_norm_error(&e))
+				n++;
+		}
+	}
+	report(name, now() - start, n);
+	delete l;
+	delete[] s;
+}
+
+
+/*
+ * A whole scan of a capture, per sample.  The burst is found, so this
+ * includes one freq_detect().
+ */
+static void bench_scan(const char *name)
+{
+	fcch_detector *l;
+	unsigned int s_len, consumed, i;
+	complex *s;
+	float offset, snr;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	s = make_capture(&s_len);
+	l = new fcch_detector(GSM_RATE);
+	start = now();
+	for(i = 0; i < KERNEL_RUNS; i++)
+		l->scan(s, s_len, &offset, &consumed, &snr);
+	report(name, now() - start, (unsigned long long)s_len * KERNEL_RUNS);
+	delete l;
+	delete[] s;
+}
+
+
+/*
+ * freq_detect() on the FCCH burst of the capture and peak_detect() on its
+ * spectrum, per call.
+ */
+static void bench_freq_detect(const char *name)
+{
+	fcch_detector *l;
+	unsigned int s_len, i;
+	complex *s;
+	float pm, f = 0.0;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	s = make_capture(&s_len);
+	l = new fcch_detector(GSM_RATE);
+	start = now();
+	for(i = 0; i < KERNEL_RUNS * 100; i++)
+		f += l->freq_detect(s + s_len / 2, 148, &pm);
+	report(name, now() - start, KERNEL_RUNS * 100);
+	if(f == 0.0)
+		printf("\t(no peak)\n");
+	delete l;
+	delete[] s;
+}
+
+
+static void bench_peak_detect(const char *name)
+{
+	complex *s, peak;
+	unsigned int i;
+	float avg_power, f = 0.0;
+	double start;
+
+	if(!selected(name))
+		return;
+
+	// a tone between bins 256 and 257 over some noise
+	s = new complex[FFT_SIZE];
+	srand(1);
+	for(i = 0; i < FFT_SIZE; i++)
+		s[i] = complex((rand() % 512) - 256, (rand() % 512) - 256) +
+		   complex(65536.0, 0.0) * (float)(1.0 / (1.0 + fabs(i - 256.3)));
+	start = now();
+	for(i = 0; i < KERNEL_RUNS * 100; i++)
+		f += peak_detect(s, FFT_SIZE, &peak, &avg_power);
+	report(name, now() - start, KERNEL_RUNS * 100);
+	if(f == 0.0)
+		printf("\t(no peak)\n");
+	delete[] s;
+}
+
+
+// c0_detect()'s channel power, per sample
+static void bench_vectornorm2(const char *name)
+{
+	unsigned int s_len, i;
+	complex *s;
+	double start, e = 0.0;
+
+	if(!selected(name))
+		return;
+
+	s = make_capture(&s_len);
+	start = now();
+	for(i = 0; i < KERNEL_RUNS * 10; i++)
+		e += vectornorm2(s, s_len);
+	report(name, now() - start, (unsigned long long)s_len * KERNEL_RUNS * 10);
+	if(e == 0.0)
+		printf("\t(no energy)\n");
+	delete[] s;
+}
+
+
+/*
+ * One search as offset_detect() does it: cycle the USB buffer, sized as
+ * usrp_source sizes it, and scan captures with a detector.  Returns the time
+ * per search.
+ */
+static double run_searches(float *offset)
+{
+	typed_circular_buffer<complex> *cb;
+	typed_circular_buffer<complex>::view v;
+	fcch_detector *l;
+	unsigned int i, cb_len, s_len, consumed;
+	complex *s;
+	float snr;
+	double start;
+
+	s = make_capture(&s_len);
+	cb_len = g_low_memory? 2 * s_len : USB_CB_LEN;
+	cb = new typed_circular_buffer<complex>(cb_len, 0, 1);
+	l = new fcch_detector(GSM_RATE);
+
+	start = now();
+	*offset = 0.0;
+	for(i = 0; i < SEARCHES * (USB_CB_LEN / s_len + 1); i++)
+	{
+		cb->write(s, s_len);
+		v = cb->readable();
+		if(i % (USB_CB_LEN / s_len + 1))
+		{
+			cb->consume(s_len);
+			continue;
+		}
+		if(!l->scan(v.data, s_len, offset, &consumed, &snr))
+			*offset = 0.0;
+		cb->consume(s_len);
+	}
+	start = (now() - start) / SEARCHES;
+
+	delete l;
+	delete cb;
+	delete[] s;
+	return start;
+}
+
+
+/*
+ * Peak RSS of the searches in each memory profile.  Each profile runs in a
+ * child process so that their peaks don't mix.
+ */
+static void bench_memory(const char *name, int low_memory)
+{
+	int fd[2], status;
+	pid_t pid;
+	struct rusage ru;
+	float offset = 0.0;
+	double t = 0.0;
+
+	if(!selected(name))
+		return;
+
+	if(pipe(fd))
+		return;
+	if(!(pid = fork()))
+	{
+		g_low_memory = low_memory;
+		t = run_searches(&offset);
+		if((write(fd[1], &t, sizeof(t)) < 0) ||
+		   (write(fd[1], &offset, sizeof(offset)) < 0))
+			_exit(1);
+		_exit(0);
+	}
+	close(fd[1]);
+	if((read(fd[0], &t, sizeof(t)) < 0) ||
+	   (read(fd[0], &offset, sizeof(offset)) < 0))
+		t = 0.0;
+	close(fd[0]);
+	if(wait4(pid, &status, 0, &ru) == -1)
+		return;
+	printf("%-32s %10ld kB peak RSS %8.3f ms/search  offset %.1f Hz\n",
+	   name, ru.ru_maxrss, t * 1e3, offset - GSM_RATE / 4);
+}
+
+
+/*
+ * Write the results as a baseline for -b.
+ */
+static int write_baseline(const char *fname)
+{
+	FILE *fp;
+	unsigned int i;
+
+	if(!(fp = fopen(fname, "w")))
+	{
+		perror(fname);
+		return -1;
+	}
+	for(i = 0; i < n_results; i++)
+		fprintf(fp, "%s\t%.3f\t%.0f\n", results[i].name, results[i].ns, results[i].rate);
+	fclose(fp);
+	return 0;
+}
+
+
+/*
+ * Compare the results with a baseline.  Returns the number of benchmarks
+ * that got slower by more than threshold percent, -1 if the baseline can't
+ * be read.
+ */
+static int compare_baseline(const char *fname, double threshold)
+{
+	FILE *fp;
+	char line[256], *tab;
+	unsigned int i;
+	double ns, change;
+	int slower = 0;
+
+	if(!(fp = fopen(fname, "r")))
+	{
+		perror(fname);
+		return -1;
+	}
+	printf("\n%-32s %10s %10s %8s\n", "against baseline", "base ns", "ns", "change");
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(!(tab = strchr(line, '\t')))
+			continue;
+		*tab = 0;
+		ns = strtod(tab + 1, 0);
+		for(i = 0; i < n_results; i++)
+			if(!strcmp(results[i].name, line))
+				break;
+		if((i == n_results) || (ns <= 0.0))
+			continue;
+		change = 100.0 * (results[i].ns - ns) / ns;
+		printf("%-32s %10.2f %10.2f %+7.1f%%%s\n", line, ns, results[i].ns,
+		   change, (change > threshold)? "  SLOWER" : "");
+		if(change > threshold)
+			slower++;
+	}
+	fclose(fp);
+	return slower;
+}
+
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-f name] [-o baseline] [-b baseline [-t percent]]\n", prog);
+	printf("\t-f\tonly run the benchmarks whose name contains this\n");
+	printf("\t-o\twrite the results to a baseline file\n");
+	printf("\t-b\tcompare with a baseline file, exit with 1 on regressions\n");
+	printf("\t-t\tslowdown in percent that counts as a regression (default %.0f)\n", THRESHOLD);
+	exit(-1);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *out = 0, *base = 0;
+	double threshold = THRESHOLD;
+	int c, r = 0;
+
+	while((c = getopt(argc, argv, "f:o:b:t:h?")) != EOF)
+	{
+		switch(c)
+		{
+			case 'f':
+				filter = optarg;
+				break;
+
+			case 'o':
+				out = optarg;
+				break;
+
+			case 'b':
+				base = optarg;
+				break;
+
+			case 't':
+				threshold = strtod(optarg, 0);
+				break;
+
+			case 'h':
+			case '?':
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+
+	bench_cb_threads("cb threads mutex chunk=1", 0, 1);
+	bench_cb_threads("cb threads spsc chunk=1", 1, 1);
+	bench_cb_threads("cb threads mutex chunk=2048", 0, 2048);
+	bench_cb_threads("cb threads spsc chunk=2048", 1, 2048);
+	bench_cb_single("cb single mutex", 0);
+	bench_cb_single("cb single spsc", 1);
+	bench_cb_rw("cb write/read chunk=256", 256);
+	bench_cb_typed("cb typed batch=256", 256);
+	bench_cb_wake("cb wait mutex", 0);
+	bench_cb_wake("cb wait spsc", 1);
+	bench_convert("convert float d=6", 6, 0);
+	bench_convert("convert float d=1", 1, 0);
+	bench_convert("convert fixed d=6", 6, 1);
+	bench_norm_error("next_norm_error");
+	bench_scan("scan");
+	bench_freq_detect("freq_detect");
+	bench_peak_detect("peak_detect");
+	bench_vectornorm2("vectornorm2");
+	bench_memory("memory default", 0);
+	bench_memory("memory low (-L)", 1);
+
+	if(out && write_baseline(out))
+		r = 2;
+	if(base)
+	{
+		c = compare_baseline(base, threshold);
+		if(c < 0)
+			r = 2;
+		else if(c > 0)
+		{
+			printf("%d benchmark(s) slower than the baseline\n", c);
+			r = 1;
+		}
+	}
+	return r;
+}
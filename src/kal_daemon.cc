@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * kal --daemon
+ *
+ *	Opens the device once and serves requests on a Unix socket, one line
+ *	each:
+ *
+ *		calibrate chan=42 [band=GSM900] [ppm=0.1] [track=1]
+ *		calibrate freq=943.4e6 ...
+ *		scan band=DCS
+ *		scan band=GSM900,DCS
+ *
+ *	and answers each with one line of JSON.  ppm is the tolerance of -a.
+ *
+ *	The device keeps streaming and the detector keeps its FFTW plans, so
+ *	a request only takes as long as its measurement.  Measurements run one
+ *	at a time.  Clients with requests waiting are served in turn, one
+ *	request each, so a client sending many requests can't starve others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "libkal.h"
+#include "kal_daemon.h"
+#include "kal_shm.h"
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const unsigned int	MAX_CLIENTS	= 16;
+static const unsigned int	REQUEST_LEN	= 256;
+static const unsigned int	MAX_CHANNELS	= 1024;	// more than all bands have
+static const unsigned int	MAX_BANDS	= 6;
+
+/*
+ * Client sockets don't block.  A reply is kept in out until the client
+ * reads it and the client's next request waits until then, so a client
+ * that doesn't read only holds up itself.
+ */
+struct client
+{
+	int		fd;
+	int		eof;		// no more requests, answer what we have
+	char		buf[REQUEST_LEN];
+	unsigned int	len;
+	char		*out;
+	size_t		out_off,	// sent
+			out_len,
+			out_size;
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void stop_handler(int)
+{
+	g_stop = 1;
+}
+
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void client_close(client *c)
+{
+	free(c->out);
+	c->out = 0;
+	close(c->fd);
+	c->fd = -1;
+}
+
+
+// forget what c still wants, it gets closed once nothing is left
+static void client_drop(client *c)
+{
+	c->eof = 1;
+	c->len = 0;
+	c->out_off = c->out_len = 0;
+}
+
+
+// length of the first request including its newline, or 0
+static unsigned int request_len(const client *c)
+{
+	const char *nl = (const char *)memchr(c->buf, '\n', c->len);
+
+	return nl? nl - c->buf + 1 : 0;
+}
+
+
+// close c if it is done, returns whether it was
+static int client_done(client *c)
+{
+	if(!c->eof || request_len(c) || c->out_len)
+		return 0;
+	client_close(c);
+	return 1;
+}
+
+
+// append to the reply of c
+static void reply(client *c, const char *fmt, ...)
+{
+	va_list ap;
+	size_t size;
+	char *out;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(0, 0, fmt, ap);
+	va_end(ap);
+	if(n < 0)
+		return;
+
+	if(c->out_len + n + 1 > c->out_size)
+	{
+		size = 2 * (c->out_len + n + 1);
+		if(!(out = (char *)realloc(c->out, size)))
+		{
+			fprintf(stderr, "error: out of memory for a reply\n");
+			client_drop(c);
+			return;
+		}
+		c->out = out;
+		c->out_size = size;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(c->out + c->out_len, c->out_size - c->out_len, fmt, ap);
+	va_end(ap);
+	c->out_len += n;
+}
+
+
+// send as much of the reply of c as the socket takes
+static void flush_client(client *c)
+{
+	ssize_t r;
+
+	while(c->out_off < c->out_len)
+	{
+		r = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+		if(r > 0)
+			c->out_off += r;
+		else if((r < 0) && (errno == EINTR))
+			continue;
+		else if((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			return;
+		else
+		{
+			client_drop(c);
+			return;
+		}
+	}
+	c->out_off = c->out_len = 0;
+}
+
+
+static void reply_error(client *c, const char *msg)
+{
+	reply(c, "{\"error\": \"%s\"}\n", msg);
+}
+
+
+static void calibrate(kal_session *s, client *c, char *args)
+{
+	int chan = -1, band = 0, track = 0;
+	double freq = -1.0, t;
+	float tolerance = 0.0;
+	kal_calibration r;
+	char *tok, *save, *v;
+
+	for(tok = strtok_r(args, " \t", &save); tok; tok = strtok_r(0, " \t", &save))
+	{
+		if(!(v = strchr(tok, '=')))
+			return reply_error(c, "expected key=value");
+		*v++ = 0;
+		if(!strcmp(tok, "chan"))
+			chan = strtol(v, 0, 0);
+		else if(!strcmp(tok, "freq"))
+			freq = strtod(v, 0);
+		else if(!strcmp(tok, "band"))
+		{
+			if((band = kal_band(v)) < 0)
+				return reply_error(c, "invalid band");
+		}
+		else if(!strcmp(tok, "ppm"))
+			tolerance = strtod(v, 0);
+		else if(!strcmp(tok, "track"))
+			track = strtol(v, 0, 0);
+		else
+			return reply_error(c, "unknown argument");
+	}
+	if(freq < 0.0)
+	{
+		if(chan < 0)
+			return reply_error(c, "must give chan or freq");
+		freq = kal_channel_freq(chan, band);
+	}
+	if((freq < 869e6) || (2e9 < freq))
+		return reply_error(c, "bad frequency");
+
+	t = now();
+	if(kal_calibrate(s, freq, track, tolerance, &r))
+		return reply_error(c, "calibration failed");
+	t = now() - t;
+	kal_shm_publish(chan, freq, r.ppm, r.ppm_stddev, 0.0, r.bursts);
+
+	reply(c, "{\"request\": \"calibrate\", \"chan\": ");
+	if(chan < 0)
+		reply(c, "null");
+	else
+		reply(c, "%d", chan);
+	reply(c, ", \"freq\": %.0f, "
+	   "\"ppm\": %.3f, \"ppm_stddev\": %.4f, \"offset\": %.1f, \"min\": %.1f, \"max\": %.1f, "
+	   "\"stddev\": %.2f, \"bursts\": %u, \"ci\": %.3f, \"snr\": %.1f, "
+	   "\"overruns\": %u, \"not_found\": %u, \"misses\": %u, "
+	   "\"tuner_gain\": %d, \"seconds\": %.3f}\n",
+	   freq, r.ppm, r.ppm_stddev, r.offset, r.min, r.max, r.stddev, r.bursts, r.ci,
+	   r.snr, r.overruns, r.notfound, r.misses, r.tuner_gain, t);
+}
+
+
+static void scan(kal_session *s, client *c, char *args, kal_channel *chans)
+{
+	int bands[MAX_BANDS], nb = 0, i, n;
+	double t;
+	char *tok, *save, *v;
+
+	for(tok = strtok_r(args, " \t", &save); tok; tok = strtok_r(0, " \t", &save))
+	{
+		if(!(v = strchr(tok, '=')))
+			return reply_error(c, "expected key=value");
+		*v++ = 0;
+		if(strcmp(tok, "band"))
+			return reply_error(c, "unknown argument");
+		if((nb = kal_bands(v, bands, MAX_BANDS)) < 0)
+			return reply_error(c, "invalid band");
+	}
+	if(nb <= 0)
+		return reply_error(c, "must give band");
+
+	t = now();
+	if((n = kal_scan_bands(s, bands, nb, chans, MAX_CHANNELS)) < 0)
+		return reply_error(c, "scan failed");
+	t = now() - t;
+
+	reply(c, "{\"request\": \"scan\", \"band\": \"");
+	for(i = 0; i < nb; i++)
+		reply(c, "%s%s", i? "," : "", kal_band_name(bands[i]));
+	reply(c, "\", \"seconds\": %.3f, \"channels\": [", t);
+	for(i = 0; i < n; i++)
+	{
+		reply(c, "%s{\"chan\": %d, \"band\": \"%s\", \"freq\": %.0f, \"power\": %.0f, "
+		   "\"found\": %s, \"offset\": %.1f, \"snr\": %.1f, \"tuner_gain\": %d}", i? ", " : "",
+		   chans[i].chan, kal_band_name(chans[i].band), chans[i].freq, chans[i].power,
+		   chans[i].found? "true" : "false", chans[i].offset, chans[i].snr, chans[i].tuner_gain);
+	}
+	reply(c, "]}\n");
+}
+
+
+// answer the first request of c and remove it
+static void serve(kal_session *s, client *c, kal_channel *chans)
+{
+	unsigned int len = request_len(c);
+	char *cmd, *args;
+
+	c->buf[len - 1] = 0;
+	if((cmd = strchr(c->buf, '\r')))
+		*cmd = 0;
+
+	cmd = c->buf + strspn(c->buf, " \t");
+	args = cmd + strcspn(cmd, " \t");
+	if(*args)
+		*args++ = 0;
+
+	if(!strcmp(cmd, "calibrate"))
+		calibrate(s, c, args);
+	else if(!strcmp(cmd, "scan"))
+		scan(s, c, args, chans);
+	else if(*cmd)
+		reply_error(c, "unknown request");
+
+	// dropped while answering
+	if(c->len < len)
+		return;
+	c->len -= len;
+	memmove(c->buf, c->buf + len, c->len);
+}
+
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "error: socket path too long\n");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+
+	// a socket left behind by an earlier run
+	unlink(path);
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, MAX_CLIENTS))
+	{
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static void accept_client(int lfd, client *clients)
+{
+	unsigned int i;
+	int fd;
+
+	if((fd = accept(lfd, 0, 0)) < 0)
+		return;
+	for(i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(clients[i].fd < 0)
+			break;
+	}
+	if((i == MAX_CLIENTS) || (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0))
+	{
+		static const char busy[] = "{\"error\": \"too many clients\"}\n";
+
+		send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+		close(fd);
+		return;
+	}
+	clients[i].fd = fd;
+	clients[i].eof = 0;
+	clients[i].len = 0;
+	clients[i].out = 0;
+	clients[i].out_off = clients[i].out_len = clients[i].out_size = 0;
+}
+
+
+static void read_client(client *c)
+{
+	ssize_t r;
+
+	r = read(c->fd, c->buf + c->len, REQUEST_LEN - c->len);
+	if(r > 0)
+	{
+		c->len += r;
+		if((c->len == REQUEST_LEN) && !request_len(c))
+		{
+			client_drop(c);
+			reply_error(c, "request too long");
+			flush_client(c);
+		}
+	}
+	else if(!r || (errno != EINTR && errno != EAGAIN))
+		c->eof = 1;
+	client_done(c);
+}
+
+
+int kal_daemon(const char *path, const kal_options *o)
+{
+	client clients[MAX_CLIENTS];
+	struct pollfd pfd[MAX_CLIENTS + 1];
+	unsigned int i, j, n, next = 0, waiting;
+	kal_channel *chans;
+	kal_session *s;
+	int lfd, r = 0;
+
+	if(!(s = kal_open(o)))
+		return -1;
+	if((lfd = listen_on(path)) < 0)
+	{
+		kal_close(s);
+		return -1;
+	}
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("kal: listening on %s\n", path);
+	fflush(stdout);
+
+	chans = new kal_channel[MAX_CHANNELS];
+	for(i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	while(!g_stop)
+	{
+		waiting = 0;
+		n = 0;
+		pfd[n].fd = lfd;
+		pfd[n++].events = POLLIN;
+		for(i = 0; i < MAX_CLIENTS; i++)
+		{
+			client *c = &clients[i];
+
+			if(c->fd < 0)
+				continue;
+			if(request_len(c) && !c->out_len)
+				waiting++;
+			pfd[n].fd = c->fd;
+			pfd[n].events = 0;
+			if(!c->eof && (c->len < REQUEST_LEN))
+				pfd[n].events |= POLLIN;
+			if(c->out_len)
+				pfd[n].events |= POLLOUT;
+			if(pfd[n].events)
+				n++;
+		}
+
+		// only block when there is nothing to do
+		if(poll(pfd, n, waiting? 0 : -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			r = -1;
+			break;
+		}
+
+		for(i = 1; i < n; i++)
+		{
+			for(j = 0; j < MAX_CLIENTS; j++)
+			{
+				if(clients[j].fd == pfd[i].fd)
+					break;
+			}
+			if(j == MAX_CLIENTS)
+				continue;
+			if(pfd[i].revents & POLLOUT)
+			{
+				flush_client(&clients[j]);
+				if(client_done(&clients[j]))
+					continue;
+			}
+			if(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+				read_client(&clients[j]);
+		}
+
+		/*
+		 * Read what a new client sent before serving anyone, it may have
+		 * connected while a measurement was running.
+		 */
+		if(pfd[0].revents & POLLIN)
+		{
+			accept_client(lfd, clients);
+			continue;
+		}
+
+		/*
+		 * The next client after the last one served that has a request
+		 * and has read its last reply.
+		 */
+		for(i = 0; i < MAX_CLIENTS; i++)
+		{
+			j = (next + i) % MAX_CLIENTS;
+			if((clients[j].fd < 0) || !request_len(&clients[j]) || clients[j].out_len)
+				continue;
+			serve(s, &clients[j], chans);
+			flush_client(&clients[j]);
+			client_done(&clients[j]);
+			next = j + 1;
+			break;
+		}
+	}
+
+	for(i = 0; i < MAX_CLIENTS; i++)
+	{
+		if(clients[i].fd >= 0)
+			client_close(&clients[i]);
+	}
+	close(lfd);
+	unlink(path);
+	delete[] chans;
+	kal_close(s);
+	return r;
+}
+
+#else
+
+int kal_daemon(const char *, const kal_options *)
+{
+	fprintf(stderr, "error: --daemon needs Unix domain sockets\n");
+	return -1;
+}
+
+#endif /* _WIN32 */
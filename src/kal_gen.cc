@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * kal_gen
+ *
+ *	Writes a synthetic GSM carrier, see gsm_gen, as an rtl_sdr file of
+ *	interleaved unsigned bytes.  At the default 1.625 MS/s the file can be
+ *	fed to kal -F.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "gsm_gen.h"
+
+static const unsigned int	CHUNK	= 16384;
+
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] <output file | ->\n", prog);
+	printf("\t-r\tsample rate (default: %.0f)\n", GEN_RATE);
+	printf("\t-t\tseconds to generate (default: 10)\n");
+	printf("\t-f\tcarrier frequency offset in Hz\n");
+	printf("\t-S\tcarrier to noise ratio in dB (default: no noise)\n");
+	printf("\t-a\tcarrier amplitude, full scale is 1 (default: 0.5)\n");
+	printf("\t-D\tDC offset as i,q, full scale is 1\n");
+	printf("\t-I\tIQ imbalance as gain dB,phase degrees\n");
+	printf("\t-s\trandom seed\n");
+	printf("\t-c\twrite complex floats instead of bytes\n");
+	exit(-1);
+}
+
+
+int main(int argc, char **argv)
+{
+	double rate = GEN_RATE, secs = 10.0, offset = 0.0, snr = 0.0, amplitude = 0.5;
+	double dc_i = 0.0, dc_q = 0.0, iq_gain = 0.0, iq_phase = 0.0;
+	unsigned int seed = 1, noise = 0, cfile = 0, n;
+	unsigned long long len, done;
+	unsigned char *u8;
+	complex *c;
+	FILE *fp;
+	gsm_gen *g;
+	int ch;
+
+	while((ch = getopt(argc, argv, "r:t:f:S:a:D:I:s:ch?")) != EOF)
+	{
+		switch(ch)
+		{
+			case 'r':
+				rate = strtod(optarg, 0);
+				break;
+
+			case 't':
+				secs = strtod(optarg, 0);
+				break;
+
+			case 'f':
+				offset = strtod(optarg, 0);
+				break;
+
+			case 'S':
+				snr = strtod(optarg, 0);
+				noise = 1;
+				break;
+
+			case 'a':
+				amplitude = strtod(optarg, 0);
+				break;
+
+			case 'D':
+				if(sscanf(optarg, "%lf,%lf", &dc_i, &dc_q) != 2)
+					usage(argv[0]);
+				break;
+
+			case 'I':
+				if(sscanf(optarg, "%lf,%lf", &iq_gain, &iq_phase) != 2)
+					usage(argv[0]);
+				break;
+
+			case 's':
+				seed = strtoul(optarg, 0, 0);
+				break;
+
+			case 'c':
+				cfile = 1;
+				break;
+
+			case 'h':
+			case '?':
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+	if((optind != argc - 1) || (rate <= 0.0) || (rate > GEN_RATE) || (secs <= 0.0))
+		usage(argv[0]);
+
+	if(!strcmp(argv[optind], "-"))
+		fp = stdout;
+	else if(!(fp = fopen(argv[optind], "wb")))
+	{
+		perror(argv[optind]);
+		return -1;
+	}
+
+	g = new gsm_gen(rate, offset, seed);
+	g->set_amplitude(amplitude);
+	if(noise)
+		g->set_snr(snr);
+	g->set_dc(dc_i, dc_q);
+	g->set_iq_imbalance(iq_gain, iq_phase);
+
+	if(fabs(g->sample_rate() - rate) > 1.0)
+		fprintf(stderr, "%s: generating at %.1f S/s\n", argv[0], g->sample_rate());
+
+	len = (unsigned long long)(secs * g->sample_rate());
+	c = new complex[CHUNK];
+	u8 = new unsigned char[2 * CHUNK];
+	for(done = 0; done < len; done += n)
+	{
+		n = (len - done < CHUNK)? (unsigned int)(len - done) : CHUNK;
+		if(cfile)
+		{
+			g->generate(c, n);
+			if(fwrite(c, sizeof(complex), n, fp) != n)
+				break;
+		}
+		else
+		{
+			g->generate_u8(u8, n);
+			if(fwrite(u8, 2, n, fp) != n)
+				break;
+		}
+	}
+	if(done < len)
+		perror("write");
+
+	delete[] u8;
+	delete[] c;
+	delete g;
+	if(fp != stdout)
+		fclose(fp);
+	return (done < len)? -1 : 0;
+}
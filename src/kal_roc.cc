@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * kal_roc
+ *
+ *	Detection probability of fcch_detector::scan() against SNR, frequency
+ *	offset, capture length, the detector's thresholds, the step size of its
+ *	filter and how much of the capture each scan sees.  Each point of the
+ *	sweep scans the same captures, so that only the swept parameter changes.
+ *	Every attempt starts from the same untrained filter.
+ *
+ *	For each point it reports:
+ *
+ *		pd	bursts found within the tolerance of the true offset
+ *		wrong	bursts found elsewhere
+ *		conv	samples from the start of a found burst until the error
+ *			went under the limit, how long the filter took to lock
+ *		pfa	bursts found in captures of noise alone
+ *		cpu	CPU time per attempt
+ *
+ *	The first FCCH burst of a capture comes -d frames in, after normal
+ *	bursts, so that the filter has to lock on it.
+ *
+ *	With -T, a capture is also scanned the way c0_detect() scans a channel:
+ *	that many frames at a time, each scan with the last frame of the one
+ *	before, until a burst is found or the capture ends.
+ *
+ *	Captures come from gsm_gen or, with -F, from an rtl_sdr file recorded
+ *	at 1.625 MS/s whose offset is given with -f.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "fcch_detector.h"
+#include "gsm_gen.h"
+#include "u8_converter.h"
+
+int g_debug = 0;
+int g_low_memory = 0;
+int g_profile = 0;
+
+static const unsigned int	MAX_LIST	= 32;
+static const double		SCALE		= 32768.0;	// usrp_source's sample scale
+static const unsigned int	FILE_DECIMATION	= 6;
+static const unsigned int	FRAME_LEN	= 1250;		// samples at the GSM rate
+static const unsigned int	FCCH_SPACING	= 10 * FRAME_LEN;	// gsm_gen's
+
+struct list
+{
+	double		v[MAX_LIST];
+	unsigned int	n;
+};
+
+
+static int parse_list(const char *s, list *l)
+{
+	char *end;
+
+	for(l->n = 0; *s && (l->n < MAX_LIST); s = end + (*end == ','))
+	{
+		l->v[l->n++] = strtod(s, &end);
+		if((end == s) || (*end && (*end != ',')))
+			return -1;
+	}
+	return l->n? 0 : -1;
+}
+
+
+static double cpu_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// symbols for frames TDMA frames and a burst, like offset_detect() captures
+static unsigned int capture_len(double frames)
+{
+	return (unsigned int)ceil(frames * 8 * 156.25 + 156.25);
+}
+
+
+/*
+ * Read the next len samples of the file, decimated to the GSM rate.  Starts
+ * over at the end.
+ */
+static int read_capture(FILE *fp, u8_converter *conv, complex *s, unsigned int len)
+{
+	unsigned char buf[2 * FILE_DECIMATION * 256];
+	unsigned int n, done;
+
+	for(done = 0; done < len; done += n)
+	{
+		n = len - done;
+		if(n > 256)
+			n = 256;
+		if(fread(buf, 2 * FILE_DECIMATION, n, fp) != n)
+		{
+			rewind(fp);
+			if(fread(buf, 2 * FILE_DECIMATION, n, fp) != n)
+				return -1;
+		}
+		conv->convert(buf, 2 * FILE_DECIMATION * n, FILE_DECIMATION, s + done, n);
+	}
+	return 0;
+}
+
+
+struct result
+{
+	unsigned int	found,
+			wrong,
+			false_alarms;
+	double		cpu,
+			conv;		// summed over found
+};
+
+
+/*
+ * Like c0_detect(), scan steps of step samples with a frame of the step before
+ * until a burst is found, or all of s at once if step is 0.
+ */
+static unsigned int scan_steps(fcch_detector *l, const complex *s, unsigned int len, unsigned int step, float *f, unsigned int *pos)
+{
+	unsigned int start = 0, end, consumed;
+	float snr;
+
+	if(!step)
+		return l->scan(s, len, f, &consumed, &snr, pos);
+
+	for(end = (step < len)? step : len;; end = (end + step < len)? end + step : len)
+	{
+		if(l->scan(s + start, end - start, f, &consumed, &snr, pos))
+		{
+			*pos += start;
+			return 1;
+		}
+		if(end >= len)
+			return 0;
+		start = end - FRAME_LEN;
+	}
+}
+
+
+/*
+ * Scan each capture in turn, from the same filter state.
+ */
+static void run(fcch_detector *l, const lms_state *start, complex **caps, unsigned int n_caps, unsigned int len, unsigned int step, unsigned int lead, double offset, double tolerance, result *r, unsigned int noise)
+{
+	unsigned int i, pos;
+	float f;
+	double t;
+
+	t = cpu_now();
+	for(i = 0; i < n_caps; i++)
+	{
+		l->set_state(start);
+		if(!scan_steps(l, caps[i], len, step, &f, &pos))
+			continue;
+		if(noise)
+			r->false_alarms++;
+		else if(fabs(f - GSM_RATE / 4 - offset) <= tolerance)
+		{
+			r->found++;
+			r->conv += (pos + l->get_delay() + FCCH_SPACING - lead) % FCCH_SPACING;
+		}
+		else
+			r->wrong++;
+	}
+	r->cpu += cpu_now() - t;
+}
+
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("\t-n\tattempts per point (default: 100)\n");
+	printf("\t-S\tcomma separated SNRs in dB (default: 0,5,10,20)\n");
+	printf("\t-f\tcomma separated frequency offsets in Hz (default: 0,10000)\n");
+	printf("\t-l\tcomma separated capture lengths in frames (default: 4,8,12)\n");
+	printf("\t-L\tcomma separated error limits, times the average (default: 0.7)\n");
+	printf("\t-P\tcomma separated peak to mean thresholds (default: 50)\n");
+	printf("\t-m\tcomma separated step sizes, 0 fixed, 1 variable (default: 0,1)\n");
+	printf("\t-d\tframes before the first FCCH burst (default: 0)\n");
+	printf("\t-T\tcomma separated frames per scan, at least 1, 0 for the whole capture (default: 0)\n");
+	printf("\t-t\toffset tolerance in Hz (default: 100)\n");
+	printf("\t-F\tscan an rtl_sdr file at 1.625 MS/s instead, its offset given by -f\n");
+	printf("\t-s\trandom seed\n");
+	printf("\t-c\tcomma separated values instead of a table\n");
+	exit(-1);
+}
+
+
+int main(int argc, char **argv)
+{
+	list snrs, offsets, lens, limits, pms, steps, scans;
+	unsigned int trials = 100, seed = 1, csv = 0, lead = 0, i, a, b, c, d, e, m, k, len, step, max_len;
+	double tolerance = 100.0;
+	const char *fname = 0;
+	complex **caps, **noise, *skip = 0;
+	fcch_detector *l;
+	lms_state start;
+	u8_converter *conv = 0;
+	FILE *fp = 0;
+	gsm_gen *g;
+	result r, rn;
+	int ch;
+
+	parse_list("0,5,10,20", &snrs);
+	parse_list("0,10000", &offsets);
+	parse_list("4,8,12", &lens);
+	parse_list("0.7", &limits);
+	parse_list("50", &pms);
+	parse_list("0,1", &steps);
+	parse_list("0", &scans);
+	while((ch = getopt(argc, argv, "n:S:f:l:L:P:m:d:T:t:F:s:ch?")) != EOF)
+	{
+		switch(ch)
+		{
+			case 'n':
+				trials = strtoul(optarg, 0, 0);
+				break;
+
+			case 'S':
+				if(parse_list(optarg, &snrs))
+					usage(argv[0]);
+				break;
+
+			case 'f':
+				if(parse_list(optarg, &offsets))
+					usage(argv[0]);
+				break;
+
+			case 'l':
+				if(parse_list(optarg, &lens))
+					usage(argv[0]);
+				break;
+
+			case 'L':
+				if(parse_list(optarg, &limits))
+					usage(argv[0]);
+				break;
+
+			case 'P':
+				if(parse_list(optarg, &pms))
+					usage(argv[0]);
+				break;
+
+			case 'm':
+				if(parse_list(optarg, &steps))
+					usage(argv[0]);
+				break;
+
+			case 'd':
+				lead = strtoul(optarg, 0, 0) * FRAME_LEN;
+				if(lead >= FCCH_SPACING)
+					usage(argv[0]);
+				break;
+
+			case 'T':
+				if(parse_list(optarg, &scans))
+					usage(argv[0]);
+
+				// a step has to be at least the frame it overlaps
+				for(i = 0; i < scans.n; i++)
+				{
+					if(scans.v[i] && (scans.v[i] < 1))
+						usage(argv[0]);
+				}
+				break;
+
+			case 't':
+				tolerance = strtod(optarg, 0);
+				break;
+
+			case 'F':
+				fname = optarg;
+				break;
+
+			case 's':
+				seed = strtoul(optarg, 0, 0);
+				break;
+
+			case 'c':
+				csv = 1;
+				break;
+
+			case 'h':
+			case '?':
+			default:
+				usage(argv[0]);
+				break;
+		}
+	}
+	if(!trials)
+		usage(argv[0]);
+
+	if(fname)
+	{
+		if(!(fp = fopen(fname, "rb")))
+		{
+			perror(fname);
+			return -1;
+		}
+		conv = new u8_converter;
+
+		// a file has one SNR and one offset
+		snrs.n = 1;
+		offsets.n = 1;
+	}
+
+	max_len = 0;
+	for(i = 0; i < lens.n; i++)
+		if(capture_len(lens.v[i]) > max_len)
+			max_len = capture_len(lens.v[i]);
+	caps = new complex *[trials];
+	noise = new complex *[trials];
+	for(i = 0; i < trials; i++)
+	{
+		caps[i] = new complex[max_len];
+		noise[i] = new complex[max_len];
+	}
+
+	if(lead)
+		skip = new complex[51 * FRAME_LEN];
+	l = new fcch_detector(GSM_RATE);
+	l->get_state(&start);
+
+	if(csv)
+		printf("snr_db,offset_hz,frames,limit,min_pm,step,scan,pd,wrong,conv,pfa,cpu_us\n");
+	else
+		printf("%7s %9s %6s %6s %6s %5s %4s %7s %7s %7s %7s %9s\n", "snr dB", "offset", "frames",
+		   "limit", "min pm", "step", "scan", "pd", "wrong", "conv", "pfa", "cpu us");
+	for(a = 0; a < snrs.n; a++)
+	{
+		for(b = 0; b < offsets.n; b++)
+		{
+			// the longest captures, shorter ones are their beginning
+			for(i = 0; i < trials; i++)
+			{
+				if(fp)
+				{
+					if(read_capture(fp, conv, caps[i], max_len))
+					{
+						fprintf(stderr, "error: %s is too short\n", fname);
+						return -1;
+					}
+					continue;
+				}
+				g = new gsm_gen(GSM_RATE, offsets.v[b], seed * 7919 + i);
+				g->set_snr(snrs.v[a]);
+				if(lead)
+					g->generate(skip, 51 * FRAME_LEN - lead);
+				g->generate(caps[i], max_len);
+				g->set_carrier(0);
+				g->generate(noise[i], max_len);
+				delete g;
+			}
+			for(i = 0; i < trials; i++)
+			{
+				for(c = 0; c < max_len; c++)
+				{
+					caps[i][c] *= (float)(fp? 1.0 : SCALE);
+					noise[i][c] *= (float)SCALE;
+				}
+			}
+
+			for(c = 0; c < lens.n; c++)
+			{
+				len = capture_len(lens.v[c]);
+				for(d = 0; d < limits.n; d++)
+				{
+					for(e = 0; e < pms.n; e++)
+					{
+						for(m = 0; m < steps.n; m++)
+						{
+							for(k = 0; k < scans.n; k++)
+							{
+								step = (unsigned int)(scans.v[k] * FRAME_LEN);
+								l->set_thresholds(limits.v[d], pms.v[e]);
+								l->set_step_size(steps.v[m]? LMS_VSS : LMS_FIXED);
+								memset(&r, 0, sizeof(r));
+								memset(&rn, 0, sizeof(rn));
+								run(l, &start, caps, trials, len, step, lead, offsets.v[b], tolerance, &r, 0);
+								if(!fp)
+									run(l, &start, noise, trials, len, step, lead, 0.0, tolerance, &rn, 1);
+								printf(csv? "%g,%g,%g,%g,%g,%s,%g,%.4f,%.4f,%.1f,%.4f,%.1f\n" :
+								   "%7g %9g %6g %6g %6g %5s %4g %7.3f %7.3f %7.1f %7.3f %9.1f\n",
+								   fp? NAN : snrs.v[a], offsets.v[b], lens.v[c], limits.v[d], pms.v[e],
+								   steps.v[m]? "vss" : "fixed", scans.v[k],
+								   (double)r.found / trials, (double)r.wrong / trials,
+								   (fp || !r.found)? NAN : r.conv / r.found,
+								   fp? NAN : (double)rn.false_alarms / trials, r.cpu * 1e6 / trials);
+								fflush(stdout);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	delete l;
+	for(i = 0; i < trials; i++)
+	{
+		delete[] caps[i];
+		delete[] noise[i];
+	}
+	delete[] caps;
+	delete[] noise;
+	delete[] skip;
+	delete conv;
+	if(fp)
+		fclose(fp);
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The writer's side of kal_shm.h.  There is one publisher per process and it
+ * is only called from one thread at a time.
+ *
+ * circular_buffer's memfd mapping is anonymous, other processes can't find
+ * it, so the segment is a named POSIX one.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "kal_shm.h"
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static kal_shm *shm = 0;
+
+
+int kal_shm_open(const char *name)
+{
+	size_t len = getpagesize();
+	kal_shm *s;
+	uint32_t seq;
+	int fd;
+
+	if((fd = shm_open(name, O_RDWR | O_CREAT, 0644)) == -1)
+	{
+		perror(name);
+		return -1;
+	}
+	if(ftruncate(fd, len) == -1)
+	{
+		perror(name);
+		close(fd);
+		return -1;
+	}
+	s = (kal_shm *)mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(s == MAP_FAILED)
+	{
+		perror(name);
+		return -1;
+	}
+
+	/*
+	 * Keep counting from an earlier run, readers may be in the middle of a
+	 * copy, but drop its estimate.  It may have stopped while writing.
+	 */
+	if(s->magic != KAL_SHM_MAGIC)
+		s->seq = 0;
+	seq = s->seq | 1;
+	__atomic_store_n(&s->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->magic = KAL_SHM_MAGIC;
+	s->version = KAL_SHM_VERSION;
+	s->pid = getpid();
+	s->time_ns = 0;
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+	shm = s;
+	return 0;
+}
+
+
+void kal_shm_publish(int chan, double freq, double ppm, double stddev, double rate, unsigned int bursts)
+{
+	struct timespec ts;
+	uint32_t seq;
+
+	if(!shm)
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	seq = shm->seq | 1;
+	__atomic_store_n(&shm->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	shm->ppm = ppm;
+	shm->stddev = stddev;
+	shm->rate = rate;
+	shm->freq = freq;
+	shm->chan = chan;
+	shm->bursts = bursts;
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+
+void kal_shm_close()
+{
+	if(shm)
+		munmap(shm, getpagesize());
+	shm = 0;
+}
+
+#else
+
+int kal_shm_open(const char *)
+{
+	fprintf(stderr, "error: --shm needs POSIX shared memory\n");
+	return -1;
+}
+
+
+void kal_shm_publish(int, double, double, double, double, unsigned int)
+{
+}
+
+
+void kal_shm_close()
+{
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * kal_shm
+ *
+ *	The latest oscillator error estimate in a POSIX shared memory segment,
+ *	for other processes to read at any rate without system calls.
+ *
+ *	kal publishes with --shm while tracking (-C), in daemon mode and after
+ *	a single calibration.  The segment outlives kal so that readers that
+ *	mapped it keep working across restarts; pid tells who wrote it last.
+ *
+ *	The estimate is protected by a sequence count which is odd while kal
+ *	is writing.  A reader maps the segment read only and copies it with
+ *	kal_shm_read():
+ *
+ *		int fd = shm_open(KAL_SHM_NAME, O_RDONLY, 0);
+ *		const kal_shm *s = mmap(0, sizeof(kal_shm), PROT_READ, MAP_SHARED, fd, 0);
+ *		kal_shm e;
+ *
+ *		if(!kal_shm_read(s, &e))
+ *			printf("%.3f +/- %.3f ppm\n", e.ppm, e.stddev);
+ */
+
+#ifndef KAL_SHM_H
+#define KAL_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define KAL_SHM_NAME	"/kal"
+#define KAL_SHM_MAGIC	0x6b616c70	// "kalp"
+#define KAL_SHM_VERSION	1
+
+typedef struct kal_shm
+{
+	uint32_t	magic,
+			version,
+			seq,		// odd while being written
+			pid;		// of the publisher
+	uint64_t	time_ns;	// CLOCK_REALTIME of the estimate, 0 if none
+	double		ppm,
+			stddev,		// 1 sigma uncertainty of ppm
+			rate,		// ppm/s, 0 unless tracking
+			freq;		// of the carrier in Hz
+	int32_t		chan;		// ARFCN of the carrier, -1 if unknown
+	uint32_t	bursts;		// behind the estimate
+} kal_shm;
+
+/*
+ * Copy a consistent estimate out of the segment.  Returns -1 when there is
+ * none yet or, after a few tries, when kal was stopped in the middle of an
+ * update.
+ */
+static inline int kal_shm_read(const kal_shm *s, kal_shm *e)
+{
+	unsigned int tries;
+	uint32_t seq;
+
+	for(tries = 0; tries < 1000; tries++)
+	{
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if(seq & 1)
+			continue;
+		memcpy(e, (const void *)s, sizeof(*e));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+			return ((e->magic == KAL_SHM_MAGIC) && e->time_ns)? 0 : -1;
+	}
+	return -1;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int kal_shm_open(const char *name);
+void kal_shm_publish(int chan, double freq, double ppm, double stddev, double rate, unsigned int bursts);
+void kal_shm_close();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KAL_SHM_H */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * libkal
+ *
+ *	The session owns the usrp_source and a float detector that scans and
+ *	calibrations share, so neither the device nor the FFTW plans are set
+ *	up again for each measurement.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "usrp_source.h"
+#include "fcch_detector.h"
+#include "arfcn_freq.h"
+#include "c0_detect.h"
+#include "offset.h"
+#include "profile.h"
+#include "libkal.h"
+
+int g_verbosity = 0;
+int g_debug = 0;
+int g_low_memory = 0;
+int g_profile = PROFILE_OFF;
+int g_prescan = 1;
+
+struct kal_session
+{
+	usrp_source	*u;
+	fcch_detector	*l;
+	int		hz_adjust;
+};
+
+// only one usrp_source can exist at a time
+static int open_sessions = 0;
+
+
+void kal_default_options(kal_options *o)
+{
+	memset(o, 0, sizeof(*o));
+	o->dithering = 1;
+	o->bandwidth = 200000;
+}
+
+
+/*
+ * Open the device, or the file, and set it up like kal does.
+ */
+kal_session *kal_open(const kal_options *o)
+{
+	kal_session *s;
+
+	if(open_sessions)
+	{
+		fprintf(stderr, "error: kal_open: a session is already open\n");
+		return 0;
+	}
+
+	s = new kal_session;
+	s->u = new usrp_source();
+	s->l = 0;
+	s->hz_adjust = o->hz_adjust;
+	open_sessions++;
+
+	if(o->file)
+	{
+		if(s->u->open_file(o->file) == -1)
+		{
+			fprintf(stderr, "error: usrp_source::open_file\n");
+			kal_close(s);
+			return 0;
+		}
+	}
+	else if(s->u->open(o->device) == -1)
+	{
+		fprintf(stderr, "error: usrp_source::open\n");
+		kal_close(s);
+		return 0;
+	}
+
+#if HAVE_DITHERING == 1
+	if(!s->u->set_dithering(o->dithering))
+		fprintf(stderr, "error: usrp_source::set_dithering\n");
+#endif
+
+	if(!s->u->set_gain(o->gain))
+	{
+		fprintf(stderr, "error: usrp_source::set_gain\n");
+		kal_close(s);
+		return 0;
+	}
+
+	if(o->ppm_error && (s->u->set_freq_correction(o->ppm_error) < 0))
+	{
+		fprintf(stderr, "error: usrp_source::set_freq_correction\n");
+		kal_close(s);
+		return 0;
+	}
+
+	if(!s->u->tune(900000000))
+	{
+		fprintf(stderr, "error: usrp_source::tune\n");
+		kal_close(s);
+		return 0;
+	}
+
+	if(s->u->set_bandwidth(o->bandwidth) < 0)
+	{
+		fprintf(stderr, "error: usrp_source::set_bandwidth\n");
+		kal_close(s);
+		return 0;
+	}
+
+	s->l = new fcch_detector(s->u->sample_rate());
+	return s;
+}
+
+
+void kal_close(kal_session *s)
+{
+	if(!s)
+		return;
+	delete s->l;
+	delete s->u;
+	delete s;
+	open_sessions--;
+}
+
+
+// band indicator for a name like kal -s takes, or -1
+int kal_band(const char *name)
+{
+	return str_to_bi(name);
+}
+
+
+// like kal_band() for a list like "GSM900,DCS" or "all", returns how many
+int kal_bands(const char *names, int *bands, unsigned int max)
+{
+	return str_to_bands(names, bands, max);
+}
+
+
+const char *kal_band_name(int band)
+{
+	return bi_to_str(band);
+}
+
+
+// frequency of a channel in Hz, band may be 0 for the default one
+double kal_channel_freq(int chan, int band)
+{
+	return arfcn_to_freq(chan, &band);
+}
+
+
+struct scan_result
+{
+	kal_channel	*chans;
+	unsigned int	max,
+			n;
+};
+
+
+static void add_channel(const kal_channel *c, void *arg)
+{
+	scan_result *r = (scan_result *)arg;
+
+	if(r->n < r->max)
+		r->chans[r->n++] = *c;
+}
+
+
+static bool lower_freq(const kal_channel &a, const kal_channel &b)
+{
+	return a.freq < b.freq;
+}
+
+
+/*
+ * Scan every channel of a band.  Fills in up to max channels, found or not,
+ * and returns how many.
+ */
+int kal_scan(kal_session *s, int band, kal_channel *chans, unsigned int max)
+{
+	return kal_scan_bands(s, &band, 1, chans, max);
+}
+
+
+/*
+ * The same for several bands in one sweep.  The pre-scan reports the channels
+ * it drops before the others are searched, so the channels are put in
+ * frequency order here.
+ */
+int kal_scan_bands(kal_session *s, const int *bands, unsigned int n, kal_channel *chans, unsigned int max)
+{
+	scan_result r;
+
+	r.chans = chans;
+	r.max = max;
+	r.n = 0;
+	if(c0_detect_bands(s->u, bands, n, add_channel, &r, s->l) < 0)
+		return -1;
+	std::stable_sort(chans, chans + r.n, lower_freq);
+	return r.n;
+}
+
+
+/*
+ * Calculate the offset of the local oscillator from the carrier at freq Hz,
+ * see kal -T and -a for track and tolerance.  Returns 0 on success.
+ */
+int kal_calibrate(kal_session *s, double freq, int track, float tolerance, kal_calibration *r)
+{
+	if(!s->u->tune(freq + s->hz_adjust))
+	{
+		fprintf(stderr, "error: usrp_source::tune\n");
+		return -1;
+	}
+	s->l->retune(freq);
+	return offset_detect(s->u, s->hz_adjust, s->u->m_center_freq - freq, r, track, tolerance, s->l);
+}
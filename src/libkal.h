@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * libkal
+ *
+ *	Scans and clock offset calculations without the kal command line, for
+ *	programs that want to measure repeatedly.  A session keeps the device
+ *	open and the detector's FFTW plans between measurements.
+ *
+ *	Only one session can be open at a time in a process.  Functions that
+ *	fail print why on stderr, see each for how it reports failure.
+ */
+
+#ifndef LIBKAL_H
+#define LIBKAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct kal_session kal_session;
+
+typedef struct kal_options
+{
+	unsigned int	device;		// device index
+	const char	*file;		// rtl_sdr file at 1.625 MS/s instead
+	int		gain;		// dB, 0 for auto
+	int		dithering;
+	int		ppm_error;	// initial frequency error in ppm
+	int		bandwidth;	// tuner bandwidth in Hz
+	int		hz_adjust;	// manual frequency offset in Hz
+} kal_options;
+
+// one channel of a scan
+typedef struct kal_channel
+{
+	int		chan,
+			band;		// see kal_band_name()
+	double		freq;		// Hz
+	double		power;
+	int		found;		// an FCCH burst was found
+	float		offset;		// of the burst from the channel in Hz
+	float		snr;
+	int		tuner_gain;	// dB
+} kal_channel;
+
+// result of a clock offset calculation
+typedef struct kal_calibration
+{
+	double		ppm,		// absolute error of the local oscillator
+			ppm_stddev;	// 1 sigma uncertainty of ppm
+	float		offset,		// trimmed mean of the burst offsets in Hz
+			min,
+			max,
+			stddev,
+			snr,		// average
+			ci;		// 95% confidence in ppm, with a tolerance
+	unsigned int	bursts,
+			overruns,
+			notfound,
+			misses;		// when tracking
+	int		tuner_gain;	// dB
+} kal_calibration;
+
+void kal_default_options(kal_options *o);
+
+// the session, or 0 if the device or file can't be opened
+kal_session *kal_open(const kal_options *o);
+void kal_close(kal_session *s);
+
+// band indicator for a name like kal -s takes, e.g., "DCS", or -1
+int kal_band(const char *name);
+
+// the bands of a list like "GSM900,DCS" or "all": how many, or -1
+int kal_bands(const char *names, int *bands, unsigned int max);
+
+// "unknown band indicator" for a bad one
+const char *kal_band_name(int band);
+
+// Hz, or a negative value for a channel not in the band
+double kal_channel_freq(int chan, int band);
+
+/*
+ * The number of channels filled in, found or not and in frequency order, or
+ * -1 on error.  0 is not an error.
+ */
+int kal_scan(kal_session *s, int band, kal_channel *chans, unsigned int max);
+int kal_scan_bands(kal_session *s, const int *bands, unsigned int n, kal_channel *chans, unsigned int max);
+
+// 0 on success, with the result in r, or -1
+int kal_calibrate(kal_session *s, double freq, int track, float tolerance, kal_calibration *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBKAL_H */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Calibrate against several carriers at once.
+ *
+ * The device runs undecimated, so one capture covers all channels within
+ * its bandwidth.  Each carrier gets its own down converter and FCCH detector
+ * and they all run in parallel on the same capture.  The per carrier results
+ * are then combined, weighted by their SNR.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "usrp_source.h"
+#include "fcch_detector.h"
+#include "ddc.h"
+#include "util.h"
+
+static const unsigned int	AVG_COUNT	= 100;
+static const float		OFFSET_MAX	= 40e3;
+
+extern int g_verbosity;
+
+struct carrier
+{
+	int		chan;
+	double		freq;
+	ddc		*d;
+	fcch_detector	*l;
+	complex		*buf;
+
+	// capture to work on and the result
+	const complex	*in;
+	unsigned int	in_len;
+	unsigned int	found;
+	float		offset,
+			snr;
+
+	// sorted ppm of every burst found so far
+	float		*ppm;
+	unsigned int	count;
+	double		snr_sum;
+
+	pthread_t	thread;
+};
+
+
+static void *carrier_scan(void *arg)
+{
+	carrier *c = (carrier *)arg;
+	unsigned int len;
+
+	len = c->d->process(c->in, c->in_len, c->buf);
+	c->snr = 0.0f;
+	c->found = c->l->scan(c->buf, len, &c->offset, 0, &c->snr);
+	return 0;
+}
+
+
+// combine the trimmed mean of each carrier, weighted by its SNR
+static void print_result(const carrier *c, unsigned int n, unsigned int overruns, unsigned int notfound)
+{
+	unsigned int i, trim;
+	float stddev, ppm;
+	double w, w_sum, ppm_sum;
+
+	printf("chan\t\tppm\t\t(stddev)\tbursts\tsnr\n");
+	w_sum = ppm_sum = 0.0;
+	for(i = 0; i < n; i++)
+	{
+		if(!c[i].count)
+		{
+			printf("%4d (%.1fMHz)\tnot found\n", c[i].chan, c[i].freq / 1e6);
+			continue;
+		}
+		trim = c[i].count / 10;
+		ppm = avg(c[i].ppm + trim, c[i].count - 2 * trim, &stddev);
+		w = c[i].snr_sum;
+		w_sum += w;
+		ppm_sum += w * ppm;
+		printf("%4d (%.1fMHz)\t%.2f\t\t(%.3f)\t\t%u\t%.0f\n", c[i].chan,
+		   c[i].freq / 1e6, ppm, stddev, c[i].count, c[i].snr_sum / c[i].count);
+	}
+	printf("overruns: %u\n", overruns);
+	printf("not found: %u\n", notfound);
+	printf("average absolute error: %.2f ppm\n", ppm_sum / w_sum);
+}
+
+
+int multi_offset_detect(usrp_source *u, const int *chans, const double *freqs, unsigned int n, int step)
+{
+	unsigned int i, j, s_len, new_overruns = 0, overruns = 0, total, notfound = 0;
+	float sps, ppm;
+	complex *cbuf;
+	typed_circular_buffer<complex> *cb;
+	carrier *c;
+	int r = 0;
+
+	sps = u->sample_rate() / GSM_RATE;
+
+	/*
+	 * 12 frames and 1 burst at the decimated rate, plus what the down
+	 * converters need to produce their first sample.
+	 */
+	s_len = (unsigned int)ceil((12 * 8 * 156.25 + 156.25) * sps);
+	s_len += (unsigned int)ceil(sps) * 16;
+
+	c = new carrier[n];
+	for(i = 0; i < n; i++)
+	{
+		c[i].chan = chans[i];
+		c[i].freq = freqs[i];
+		c[i].d = new ddc(u->sample_rate(), freqs[i] - u->m_center_freq, (unsigned int)round(sps));
+		c[i].l = new fcch_detector(c[i].d->sample_rate());
+		c[i].l->set_step_size(step);
+		c[i].buf = new complex[c[i].d->out_len(s_len)];
+		c[i].ppm = new float[AVG_COUNT];
+		c[i].count = 0;
+		c[i].snr_sum = 0.0;
+	}
+
+	cb = u->get_buffer();
+
+	u->start();
+	u->flush();
+	total = 0;
+	while(total < AVG_COUNT)
+	{
+		do
+		{
+			if(u->fill(s_len, &new_overruns))
+			{
+				r = -1;
+				break;
+			}
+			if(new_overruns)
+			{
+				overruns += new_overruns;
+				u->flush();
+			}
+		} while(new_overruns);
+		if(r)
+			break;
+
+		cbuf = cb->readable().data;
+		for(i = 0; i < n; i++)
+		{
+			c[i].in = cbuf;
+			c[i].in_len = s_len;
+			if(pthread_create(&c[i].thread, 0, carrier_scan, &c[i]))
+			{
+				fprintf(stderr, "error: pthread_create\n");
+				r = -1;
+				break;
+			}
+		}
+
+		// the threads that were started read cbuf until they are done
+		for(j = 0; j < i; j++)
+			pthread_join(c[j].thread, 0);
+		if(r)
+			break;
+		cb->consume(s_len);
+
+		for(i = 0; i < n; i++)
+		{
+			if(!c[i].found)
+			{
+				++notfound;
+				continue;
+			}
+
+			// FCH is a sine wave at GSM_RATE / 4
+			c[i].offset -= GSM_RATE / 4;
+			if((fabs(c[i].offset) >= OFFSET_MAX) || (c[i].count >= AVG_COUNT))
+				continue;
+
+			ppm = u->m_freq_corr - (c[i].offset / u->m_center_freq) * 1000000;
+			sorted_insert(c[i].ppm, c[i].count, ppm);
+			c[i].snr_sum += c[i].snr;
+			c[i].count += 1;
+			total += 1;
+
+			if(g_verbosity > 0)
+				printf("\tchan %4d offset %3u: %.0f \tsnr: %0.f\n", c[i].chan, c[i].count, c[i].offset, c[i].snr);
+		}
+	}
+
+	u->stop();
+	if(!r)
+		print_result(c, n, overruns, notfound);
+
+	for(i = 0; i < n; i++)
+	{
+		delete c[i].d;
+		delete c[i].l;
+		delete[] c[i].buf;
+		delete[] c[i].ppm;
+	}
+	delete[] c;
+
+	return r;
+}
@@ -25,106 +25,466 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
 #include "usrp_source.h"
 #include "fcch_detector.h"
+#include "fcch_fixed.h"
+#include "ppm_filter.h"
+#include "offset.h"
+#include "arfcn_freq.h"
+#include "kal_shm.h"
 #include "util.h"
 
 static const unsigned int	AVG_COUNT	= 100;
-static const unsigned int	AVG_THRESHOLD	= (AVG_COUNT / 10);
 static const float		OFFSET_MAX	= 40e3;
 
+/*
+ * With a tolerance, we stop as soon as the 95% confidence interval of the
+ * trimmed mean is small enough, but never before AVG_MIN or after AVG_MAX
+ * offsets.
+ */
+static const unsigned int	AVG_MIN		= 20;
+static const unsigned int	AVG_MAX		= 1000;
+static const float		CI_95		= 1.96;
+
+/*
+ * When tracking, only this many timeslots either side of a predicted FCCH
+ * burst are handed to the detector.
+ */
+static const unsigned int	TRACK_MARGIN	= 2;
+
+/*
+ * Number of consecutive predicted bursts we may miss before falling back to
+ * a full search.
+ */
+static const unsigned int	TRACK_LOST	= 4;
+
 extern int g_verbosity;
+extern int g_debug;
 
-int offset_detect(usrp_source *u, int hz_adjust, float tuner_error)
+/*
+ * State of the search for FCCH bursts in the sample stream of one channel.
+ */
+struct burst_search
 {
-	unsigned int new_overruns = 0, overruns = 0;
-	int notfound = 0;
-	unsigned int s_len, b_len, consumed, count;
-	float offset = 0.0, min = 0.0, max = 0.0, avg_offset = 0.0,
-		stddev = 0.0, sps, snr, snr_sum = 0.0f, offsets[AVG_COUNT];
-	double total_ppm;
-	complex *cbuf;
-	fcch_detector *l;
-	circular_buffer *cb;
-	int tuner_gain;
-
-	l = new fcch_detector(u->sample_rate());
+	usrp_source		*u;
+	fcch_detector		*l;
+	typed_circular_buffer<complex>	*cb;
+	fcch_detector_fixed	*lq;		// instead of l with fixed point
+	typed_circular_buffer<complex16>	*cb16;
+	int			own_l;
+	float			tuner_error;
+	int			track;
+
+	unsigned int		s_len,		// full search length
+				frame_len,
+				ts_len,
+				w_len,		// tracking window length
+				m_len;		// tracking window margin
+
+	unsigned long long	pos,		// stream index of the next sample in cb
+				last_fcch,
+				next_fcch;
+	int			tens,
+				predicted;
+	unsigned int		gap,
+				lost;
+
+	unsigned int		overruns,
+				notfound,
+				misses;
+};
+
+
+/*
+ * The FCCH occupies timeslot 0 of frames 0, 10, 20, 30 and 40 of the 51
+ * multiframe.  So bursts are 10 frames apart, except for the gap from frame
+ * 40 to frame 0 of the next multiframe which is 11 frames.
+ *
+ * tens counts the 10 frame gaps seen since the last 11 frame gap, or is -1
+ * while we don't know where we are in the multiframe.
+ */
+static unsigned int next_gap(int tens)
+{
+	return (tens == 4)? 11 : 10;
+}
+
+
+static int multiframe_step(int tens, unsigned int gap)
+{
+	if(gap == 11)
+		return 0;
+	return (tens >= 0)? tens + 1 : -1;
+}
+
+
+/*
+ * The float detector is l if given, it stays the caller's.
+ */
+static void burst_search_init(burst_search *bs, usrp_source *u, float tuner_error, int track, fcch_detector *l = 0)
+{
+	float sps;
+
+	memset(bs, 0, sizeof(*bs));
+	bs->u = u;
+	if((bs->cb16 = u->get_buffer16()))
+		bs->lq = new fcch_detector_fixed(u->sample_rate());
+	else
+	{
+		bs->l = l? l : new fcch_detector(u->sample_rate());
+		bs->own_l = !l;
+		bs->cb = u->get_buffer();
+	}
+	bs->tuner_error = tuner_error;
+	bs->track = track;
+	bs->tens = -1;
 
 	/*
 	 * We deliberately grab 12 frames and 1 burst.  We are guaranteed to
 	 * find at least one FCCH burst in this much data.
 	 */
 	sps = u->sample_rate() / GSM_RATE;
-	s_len = (unsigned int)ceil((12 * 8 * 156.25 + 156.25) * sps);
-	cb = u->get_buffer();
+	bs->s_len = (unsigned int)ceil((12 * 8 * 156.25 + 156.25) * sps);
 
-	u->start();
-	u->flush();
-	count = 0;
-	while(count < AVG_COUNT)
+	/*
+	 * Once a burst has been found, the following ones can be predicted and
+	 * we only need to look at a window of a few timeslots around each one.
+	 */
+	bs->frame_len = (unsigned int)round(8 * 156.25 * sps);
+	bs->ts_len = (unsigned int)ceil(156.25 * sps);
+	bs->m_len = TRACK_MARGIN * bs->ts_len;
+	bs->w_len = 2 * bs->m_len + bs->ts_len;
+}
+
+
+static void burst_search_free(burst_search *bs)
+{
+	if(bs->own_l)
+		delete bs->l;
+	delete bs->lq;
+	bs->l = 0;
+	bs->lq = 0;
+}
+
+
+static unsigned int burst_search_consume(burst_search *bs, unsigned int len)
+{
+	if(bs->lq)
+		return bs->cb16->consume(len);
+	return bs->cb->consume(len);
+}
+
+
+/*
+ * Scan the next len samples for an FCCH burst.
+ */
+static unsigned int burst_search_scan(burst_search *bs, unsigned int len, float *offset, unsigned int *consumed, float *snr, unsigned int *burst_pos)
+{
+	if(bs->lq)
+		return bs->lq->scan(bs->cb16->readable().data, len, offset, consumed, snr, burst_pos);
+	return bs->l->scan(bs->cb->readable().data, len, offset, consumed, snr, burst_pos);
+}
+
+
+/*
+ * Search the stream for the next FCCH burst with a sane offset.  Returns 0 on
+ * success and the offset from the expected tone in Hz.
+ */
+static int next_offset(burst_search *bs, float *offset, float *snr)
+{
+	unsigned int new_overruns = 0, consumed, burst_pos = 0, want;
+	unsigned long long w_start = 0;
+	int found;
+
+	for(;;)
 	{
+		if(bs->predicted)
+		{
+			w_start = bs->next_fcch - bs->m_len;
+			want = (unsigned int)(w_start + bs->w_len - bs->pos);
+		}
+		else
+			want = bs->s_len;
 
-		// ensure at least s_len contiguous samples are read from usrp
+		// ensure at least want contiguous samples are read from usrp
 		do
 		{
-			if(u->fill(s_len, &new_overruns))
+			if(bs->u->fill(want, &new_overruns))
 				return -1;
 			if(new_overruns)
 			{
-				overruns += new_overruns;
-				u->flush();
+				bs->overruns += new_overruns;
+				bs->u->flush();
+
+				// the stream is no longer continuous
+				bs->pos = 0;
+				bs->tens = -1;
+				bs->predicted = 0;
+				want = bs->s_len;
 			}
 		} while(new_overruns);
 
-		// get a pointer to the next samples
-		cbuf = (complex *)cb->peek(&b_len);
-
-		snr = 0.0f;
-		// search the buffer for a pure tone
-		if(l->scan(cbuf, b_len, &offset, &consumed, &snr))
+		*snr = 0.0f;
+		if(bs->predicted)
 		{
+			// skip to the start of the window
+			bs->pos += burst_search_consume(bs, (unsigned int)(w_start - bs->pos));
 
-			// FCH is a sine wave at GSM_RATE / 4
-			offset = offset - GSM_RATE / 4 - tuner_error;
+			// search only the window around the predicted burst
+			found = burst_search_scan(bs, bs->w_len, offset, &consumed, snr, &burst_pos);
+		}
+		else
+		{
+			// search the next samples for a pure tone
+			found = burst_search_scan(bs, bs->s_len, offset, &consumed, snr, &burst_pos);
 
-			// sanity check offset
-			if(fabs(offset) < OFFSET_MAX)
-			{
+			/*
+			 * Keep the samples after the burst so that the next one
+			 * can still be found in them.
+			 */
+			if(found)
+				consumed = burst_pos + bs->ts_len;
+		}
 
-				offsets[count] = offset;
-				snr_sum += snr;
-				count += 1;
+		if(found)
+		{
+			// check where we are in the multiframe
+			if(bs->predicted)
+				bs->tens = multiframe_step(bs->tens, bs->gap);
+			bs->lost = 0;
+			bs->last_fcch = bs->pos + burst_pos;
+			bs->gap = next_gap(bs->tens);
+			bs->next_fcch = bs->last_fcch + bs->gap * bs->frame_len;
+			bs->predicted = bs->track;
+		}
+		else if(bs->predicted)
+		{
+			++bs->misses;
 
-				if(g_verbosity > 0)
-					printf("\toffset %3u: %.0f \tsnr: %0.f\n", count, offset, snr);
+			/*
+			 * If we know the position in the multiframe, the burst was
+			 * most likely just too weak and we keep following the
+			 * schedule for a while.  If we don't, a missed 10 frame gap
+			 * may have been an 11 frame gap.  Otherwise fall back to a
+			 * full search.
+			 */
+			if((bs->tens >= 0) && (++bs->lost < TRACK_LOST))
+			{
+				bs->tens = multiframe_step(bs->tens, bs->gap);
+				bs->last_fcch = bs->next_fcch;
+				bs->gap = next_gap(bs->tens);
+				bs->next_fcch = bs->last_fcch + bs->gap * bs->frame_len;
 			}
+			else if((bs->tens < 0) && (bs->gap == 10))
+			{
+				bs->gap = 11;
+				bs->next_fcch = bs->last_fcch + bs->gap * bs->frame_len;
+			}
+			else
+			{
+				bs->tens = -1;
+				bs->lost = 0;
+				bs->predicted = 0;
+			}
+			if(g_debug)
+				printf("debug: predicted FCCH burst missed\n");
 		}
 		else
-			++notfound;
+			++bs->notfound;
 
 		// consume used samples
-		cb->purge(consumed);
+		bs->pos += burst_search_consume(bs, consumed);
+
+		if(found)
+		{
+			// FCH is a sine wave at GSM_RATE / 4
+			*offset = *offset - GSM_RATE / 4 - bs->tuner_error;
+
+			// sanity check offset
+			if(fabs(*offset) < OFFSET_MAX)
+				return 0;
+		}
+	}
+}
+
+
+/*
+ * The offsets are kept sorted as they arrive so the 10% trimmed mean can be
+ * recalculated after every burst.
+ */
+static double trimmed_avg(float *offsets, unsigned int count, float *stddev, float *min, float *max)
+{
+	unsigned int trim = count / 10;
+
+	if(min)
+		*min = offsets[trim];
+	if(max)
+		*max = offsets[count - trim - 1];
+	return avg(offsets + trim, count - 2 * trim, stddev);
+}
+
+
+// standard error of the trimmed mean of count offsets at freq, in ppm
+static double ppm_stddev(float stddev, unsigned int count, double freq)
+{
+	return stddev / sqrt(count - 2 * (count / 10)) / freq * 1000000;
+}
+
+
+int offset_detect(usrp_source *u, int hz_adjust, float tuner_error, kal_calibration *r, int track, float tolerance, fcch_detector *l)
+{
+	unsigned int max_count, count;
+	float offset = 0.0, stddev = 0.0, snr, snr_sum = 0.0f, offsets[AVG_MAX];
+	double ci = 0.0;
+	burst_search bs;
+
+	burst_search_init(&bs, u, tuner_error, track, l);
+
+	u->start();
+	u->flush();
+	count = 0;
+	max_count = (tolerance > 0.0)? AVG_MAX : AVG_COUNT;
+	while(count < max_count)
+	{
+		if(next_offset(&bs, &offset, &snr))
+		{
+			u->stop();
+			burst_search_free(&bs);
+			return -1;
+		}
+
+		sorted_insert(offsets, count, offset);
+		snr_sum += snr;
+		count += 1;
+
+		if(g_verbosity > 0)
+			printf("\toffset %3u: %.0f \tsnr: %0.f\n", count, offset, snr);
+
+		// stop once we are confident enough of the result
+		if((tolerance > 0.0) && (count >= AVG_MIN))
+		{
+			trimmed_avg(offsets, count, &stddev, 0, 0);
+			ci = CI_95 * ppm_stddev(stddev, count, u->m_center_freq);
+			if(ci < tolerance)
+				break;
+		}
 	}
 
 	u->stop();
-	delete l;
+	burst_search_free(&bs);
 
 	// construct stats
-	sort(offsets, AVG_COUNT);
-	avg_offset = avg(offsets + AVG_THRESHOLD, AVG_COUNT - 2 * AVG_THRESHOLD, &stddev);
-	min = offsets[AVG_THRESHOLD];
-	max = offsets[AVG_COUNT - AVG_THRESHOLD - 1];
-
-	printf("average\t\t[min, max]\t(range, stddev)\n");
-	display_freq(avg_offset);
-	printf("\t\t[%d, %d]\t(%d, %.2f)\n", (int)round(min), (int)round(max), (int)round(max - min), stddev);
-	printf("overruns: %u\n", overruns);
-	printf("not found: %u\n", notfound);
-
-	total_ppm = u->m_freq_corr - ((avg_offset + hz_adjust) / u->m_center_freq) * 1000000;
-
-	printf("average absolute error: %.2f ppm\n", total_ppm);
-	tuner_gain = u->get_tuner_gain();
-	printf("tuner gain: %ddB \tsnr: %.0f\n", tuner_gain, snr_sum/count);
+	memset(r, 0, sizeof(*r));
+	r->offset = trimmed_avg(offsets, count, &r->stddev, &r->min, &r->max);
+	r->ppm = u->m_freq_corr - ((r->offset + hz_adjust) / u->m_center_freq) * 1000000;
+	r->ppm_stddev = ppm_stddev(r->stddev, count, u->m_center_freq);
+	r->snr = snr_sum / count;
+	r->ci = ci;
+	r->bursts = count;
+	r->overruns = bs.overruns;
+	r->notfound = bs.notfound;
+	r->misses = bs.misses;
+	r->tuner_gain = u->get_tuner_gain();
 	return 0;
 }
+
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void stop_handler(int)
+{
+	g_stop = 1;
+}
+
+
+static double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/*
+ * Follow the oscillator error until interrupted.  Every burst is fed into a
+ * filter of ppm and ppm rate as soon as it is found and the current estimate
+ * is printed every interval seconds.  The detector is l if given, as for
+ * offset_detect().  The signal handlers in place before are put back.
+ */
+int offset_track(usrp_source *u, int hz_adjust, float tuner_error, float interval, fcch_detector *l)
+{
+	unsigned int bursts = 0, total = 0;
+	float offset, snr;
+	double t, next_report, ppm, freq;
+	burst_search bs;
+	ppm_filter f;
+	void (*old_int)(int), (*old_term)(int);
+	int chan, r = 0;
+
+	// keep the detector locked to the FCCH schedule
+	burst_search_init(&bs, u, tuner_error, 1, l);
+
+	g_stop = 0;
+	old_int = signal(SIGINT, stop_handler);
+	old_term = signal(SIGTERM, stop_handler);
+
+	freq = u->m_center_freq - tuner_error;
+	chan = freq_to_arfcn(freq);
+
+	printf("time\t\t\tppm\t\t(stddev)\trate (ppm/h)\tbursts\n");
+	fflush(stdout);
+
+	u->start();
+	u->flush();
+	next_report = now() + interval;
+	while(!g_stop)
+	{
+		if(next_offset(&bs, &offset, &snr))
+		{
+			r = -1;
+			break;
+		}
+
+		t = now();
+		ppm = u->m_freq_corr - ((offset + hz_adjust) / u->m_center_freq) * 1000000;
+		if(f.update(t, ppm))
+		{
+			bursts++;
+			total++;
+			if(f.valid())
+				kal_shm_publish(chan, freq, f.ppm(), f.ppm_stddev(), f.rate(), total);
+		}
+		else if(g_verbosity > 0)
+			printf("\trejected offset: %.0f \tsnr: %0.f\n", offset, snr);
+
+		if(g_verbosity > 1)
+			printf("\toffset: %.0f \tsnr: %0.f\n", offset, snr);
+
+		if((t >= next_report) && f.valid())
+		{
+			printf("%.3f\t\t%.3f\t\t(%.3f)\t\t%.3f\t\t%u\n", t,
+			   f.ppm(), f.ppm_stddev(), f.rate() * 3600, bursts);
+			fflush(stdout);
+			bursts = 0;
+
+			// don't let the cadence drift, but don't try to catch up
+			while(next_report <= t)
+				next_report += interval;
+		}
+	}
+
+	u->stop();
+	burst_search_free(&bs);
+	signal(SIGINT, old_int);
+	signal(SIGTERM, old_term);
+
+	printf("overruns: %u\n", bs.overruns);
+	printf("not found: %u\n", bs.notfound);
+	printf("tracking misses: %u\n", bs.misses);
+	return r;
+}
@@ -25,4 +25,9 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-int offset_detect(usrp_source *u, int hz_adjust, float tuner_error);
+#include "libkal.h"
+
+class fcch_detector;
+
+int offset_detect(usrp_source *u, int hz_adjust, float tuner_error, kal_calibration *r, int track = 0, float tolerance = 0.0, fcch_detector *l = 0);
+int offset_track(usrp_source *u, int hz_adjust, float tuner_error, float interval, fcch_detector *l = 0);
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+
+#include "ppm_filter.h"
+
+static const double		R_INIT		= 0.05 * 0.05;
+static const double		R_MIN		= 1e-6;
+static const double		R_ALPHA		= 1.0 / 32.0;
+static const double		RATE_VAR_INIT	= 1e-4;
+static const double		GATE		= 5.0;
+static const unsigned int	WARMUP		= 10;
+static const unsigned int	SUSPECT		= 3;	// rejections in a row
+static const unsigned int	LOCKOUT		= 8;
+
+
+ppm_filter::ppm_filter(const double q)
+{
+	m_q = q;
+	reset();
+}
+
+
+void ppm_filter::reset()
+{
+	m_r = R_INIT;
+	m_t = 0.0;
+	m_x[0] = m_x[1] = 0.0;
+	m_p[0] = m_p[1] = m_p[2] = 0.0;
+	m_n = 0;
+	m_rejected = 0;
+}
+
+
+/*
+ * Feed a measurement taken at time t (in seconds).  Returns 0 if the
+ * measurement was rejected as an outlier.  After LOCKOUT rejections in a
+ * row the filter is reset and acquires again, from this measurement.
+ */
+int ppm_filter::update(double t, double ppm)
+{
+	double dt, s, y, k0, k1, p0, p1;
+
+	if(!m_n)
+	{
+		m_x[0] = ppm;
+		m_x[1] = 0.0;
+		m_p[0] = m_r;
+		m_p[1] = 0.0;
+		m_p[2] = RATE_VAR_INIT;
+		m_t = t;
+		m_n = 1;
+		return 1;
+	}
+
+	// predict
+	dt = t - m_t;
+	if(dt < 0.0)
+		dt = 0.0;
+	m_t = t;
+	m_x[0] += m_x[1] * dt;
+	m_p[0] += 2.0 * dt * m_p[1] + dt * dt * m_p[2] + m_q * dt * dt * dt / 3.0;
+	m_p[1] += dt * m_p[2] + m_q * dt * dt / 2.0;
+	m_p[2] += m_q * dt;
+
+	// gate
+	y = ppm - m_x[0];
+	s = m_p[0] + m_r;
+	if((m_n >= WARMUP) && (y * y > GATE * GATE * s))
+	{
+		if(++m_rejected < LOCKOUT)
+			return 0;
+		reset();
+		return update(t, ppm);
+	}
+	m_rejected = 0;
+
+	// track the measurement noise
+	m_r = (1.0 - R_ALPHA) * m_r + R_ALPHA * fmax(y * y - m_p[0], R_MIN);
+	s = m_p[0] + m_r;
+
+	// correct
+	p0 = m_p[0];
+	p1 = m_p[1];
+	k0 = p0 / s;
+	k1 = p1 / s;
+	m_x[0] += k0 * y;
+	m_x[1] += k1 * y;
+	m_p[0] = (1.0 - k0) * p0;
+	m_p[1] = (1.0 - k0) * p1;
+	m_p[2] -= k1 * p1;
+
+	m_n++;
+	return 1;
+}
+
+
+// settled, and not rejecting everything since
+int ppm_filter::valid()
+{
+	return (m_n >= WARMUP) && (m_rejected < SUSPECT);
+}
+
+
+double ppm_filter::ppm()
+{
+	return m_x[0];
+}
+
+
+double ppm_filter::ppm_stddev()
+{
+	return sqrt(m_p[0]);
+}
+
+
+double ppm_filter::rate()
+{
+	return m_x[1];
+}
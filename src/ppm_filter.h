@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * ppm_filter
+ *
+ * A two state Kalman filter following the oscillator error in ppm and its
+ * rate of change in ppm per second.  The measurement noise is estimated from
+ * the innovations and, once the filter has settled, measurements too far
+ * from the prediction are rejected as false bursts.  A run of rejections
+ * means the oscillator has moved instead, e.g., with a change in
+ * temperature, and the filter starts over from the latest measurement.
+ */
+
+class ppm_filter {
+public:
+	ppm_filter(const double q = 1e-10);
+
+	int update(double t, double ppm);
+	void reset();
+	int valid();
+	double ppm();
+	double ppm_stddev();
+	double rate();
+
+private:
+	double		m_q,		// rate random walk, (ppm/s)^2 per s
+			m_r,		// measurement variance, ppm^2
+			m_t,
+			m_x[2],
+			m_p[3];		// p00, p01, p11
+	unsigned int	m_n,
+			m_rejected;	// in a row
+};
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "profile.h"
+
+/*
+ * Durations are in ns.  Below 16 ns each value has its own bucket, above
+ * that each power of 2 is split in 16, so a percentile is known to within 3%.
+ */
+#define SUB_BITS	4
+#define SUB		(1 << SUB_BITS)
+#define BUCKETS		(SUB * (43 - SUB_BITS))	// up to 2^43 ns, about 2.4 hours
+#define CHANNELS	2048
+
+struct prof_hist {
+	unsigned int		count[BUCKETS];
+	unsigned long long	n,
+				ns,
+				items;
+};
+
+struct prof_chan {
+	int		chan;
+	prof_hist	h[PROF_STAGES];
+};
+
+static const char *stage_names[PROF_STAGES] = {
+	"tune",
+	"settle",
+	"flush",
+	"fill",
+	"error",
+	"freq_detect",
+	"peak_detect",
+	"prescan",
+	"callback"
+};
+
+static prof_chan		*run = 0;
+static prof_chan		*chans[CHANNELS];
+static unsigned int		n_chans = 0;
+static int			cur = -1;	// index in chans
+static unsigned long long	run_start;
+
+
+unsigned long long profile_now()
+{
+#ifdef _WIN32
+	LARGE_INTEGER c, f;
+
+	QueryPerformanceCounter(&c);
+	QueryPerformanceFrequency(&f);
+	return (unsigned long long)(c.QuadPart * (1e9 / f.QuadPart));
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+static unsigned int bucket(unsigned long long ns)
+{
+	unsigned int b;
+
+	if(ns < SUB)
+		return ns;
+	b = 63 - __builtin_clzll(ns);
+	b = (b - SUB_BITS + 1) * SUB + ((ns >> (b - SUB_BITS)) & (SUB - 1));
+	return (b < BUCKETS)? b : BUCKETS - 1;
+}
+
+
+// the middle of bucket b
+static double bucket_ns(unsigned int b)
+{
+	unsigned int e;
+
+	if(b < SUB)
+		return b;
+	e = b / SUB - 1;
+	return (double)((SUB + b % SUB) << e) + (1ULL << e) / 2.0;
+}
+
+
+void profile_init(int mode)
+{
+	run = new prof_chan;
+	memset(run, 0, sizeof(*run));
+	run->chan = -1;
+	run_start = profile_now();
+	g_profile = mode;
+}
+
+
+/*
+ * Charge what follows to chan as well as to the run, until the next call.  A
+ * negative chan charges the run only.
+ */
+void profile_channel(int chan)
+{
+	unsigned int i;
+
+	if(!g_profile)
+		return;
+	if(chan < 0)
+	{
+		__atomic_store_n(&cur, -1, __ATOMIC_RELAXED);
+		return;
+	}
+	for(i = 0; i < n_chans; i++)
+		if(chans[i]->chan == chan)
+			break;
+	if(i == n_chans)
+	{
+		if(n_chans == CHANNELS)
+			return;
+		chans[i] = new prof_chan;
+		memset(chans[i], 0, sizeof(prof_chan));
+		chans[i]->chan = chan;
+		n_chans++;
+	}
+	__atomic_store_n(&cur, (int)i, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Stages may be timed from several threads at once, the USB callback and
+ * the multi carrier scans, so the counters are atomic.
+ */
+static void hist_add(prof_hist *h, unsigned long long ns, unsigned long long items)
+{
+	__atomic_fetch_add(&h->count[bucket(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->n, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->items, items, __ATOMIC_RELAXED);
+}
+
+
+void profile_add(unsigned int stage, unsigned long long ns, unsigned long long items)
+{
+	int c;
+
+	hist_add(&run->h[stage], ns, items);
+	if((c = __atomic_load_n(&cur, __ATOMIC_ACQUIRE)) >= 0)
+		hist_add(&chans[c]->h[stage], ns, items);
+}
+
+
+// percentile p of h, in us
+static double percentile(const prof_hist *h, double p)
+{
+	unsigned long long want, n = 0;
+	unsigned int b;
+
+	if(!h->n)
+		return 0.0;
+	want = (unsigned long long)ceil(p * h->n);
+	if(!want)
+		want = 1;
+	for(b = 0; b < BUCKETS; b++)
+	{
+		n += h->count[b];
+		if(n >= want)
+			break;
+	}
+	return bucket_ns(b) / 1e3;
+}
+
+
+static void json_stages(FILE *f, const prof_chan *c)
+{
+	unsigned int s, first = 1;
+	const prof_hist *h;
+
+	fprintf(f, "{");
+	for(s = 0; s < PROF_STAGES; s++)
+	{
+		h = &c->h[s];
+		if(!h->n)
+			continue;
+		fprintf(f, "%s\"%s\": {\"count\": %llu, \"total_s\": %.6f, "
+		   "\"p50_us\": %.1f, \"p99_us\": %.1f, \"items\": %llu}",
+		   first? "" : ", ", stage_names[s], h->n, h->ns / 1e9,
+		   percentile(h, 0.5), percentile(h, 0.99), h->items);
+		first = 0;
+	}
+	fprintf(f, "}");
+}
+
+
+static void report_json(FILE *f, double wall)
+{
+	unsigned int i;
+
+	fprintf(f, "{\"wall_s\": %.6f, \"stages\": ", wall);
+	json_stages(f, run);
+	fprintf(f, ", \"channels\": [");
+	for(i = 0; i < n_chans; i++)
+	{
+		fprintf(f, "%s{\"chan\": %d, \"stages\": ", i? ", " : "", chans[i]->chan);
+		json_stages(f, chans[i]);
+		fprintf(f, "}");
+	}
+	fprintf(f, "]}\n");
+}
+
+
+static void report_text(FILE *f, double wall)
+{
+	unsigned int i, s;
+	const prof_hist *h;
+
+	fprintf(f, "profile: %.3f s\n", wall);
+	fprintf(f, "%-12s %10s %10s %6s %10s %10s %14s\n",
+	   "stage", "count", "total s", "share", "p50 us", "p99 us", "items/s");
+	for(s = 0; s < PROF_STAGES; s++)
+	{
+		h = &run->h[s];
+		if(!h->n)
+			continue;
+		fprintf(f, "%-12s %10llu %10.3f %5.1f%% %10.1f %10.1f",
+		   stage_names[s], h->n, h->ns / 1e9, 100.0 * h->ns / 1e9 / wall,
+		   percentile(h, 0.5), percentile(h, 0.99));
+		if(h->items && h->ns)
+			fprintf(f, " %14.0f\n", h->items / (h->ns / 1e9));
+		else
+			fprintf(f, " %14s\n", "-");
+	}
+	fprintf(f, "(the callback runs on the USB thread, its share overlaps the others)\n");
+
+	if(!n_chans)
+		return;
+	fprintf(f, "\n%-6s", "chan");
+	for(s = 0; s < PROF_STAGES; s++)
+		fprintf(f, " %17s", stage_names[s]);
+	fprintf(f, "\n%-6s", "");
+	for(s = 0; s < PROF_STAGES; s++)
+		fprintf(f, " %17s", "p50/p99 us");
+	fprintf(f, "\n");
+	for(i = 0; i < n_chans; i++)
+	{
+		fprintf(f, "%-6d", chans[i]->chan);
+		for(s = 0; s < PROF_STAGES; s++)
+		{
+			h = &chans[i]->h[s];
+			if(h->n)
+				fprintf(f, " %8.0f/%8.0f", percentile(h, 0.5), percentile(h, 0.99));
+			else
+				fprintf(f, " %17s", "-");
+		}
+		fprintf(f, "\n");
+	}
+}
+
+
+void profile_report(FILE *f)
+{
+	double wall;
+
+	if(!g_profile)
+		return;
+	wall = (profile_now() - run_start) / 1e9;
+	if(g_profile == PROFILE_JSON)
+		report_json(f, wall);
+	else
+		report_text(f, wall);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * profile
+ *
+ *	Where a run spends its time.  Each stage keeps a histogram of how long
+ *	it took, for the whole run and per channel, along with how many items
+ *	(samples or bytes) it handled.  The report shows whether a scan is
+ *	bound by USB, by the settle time or by the CPU.
+ *
+ *	When profiling is off, profile_start() and profile_stop() only test
+ *	g_profile.
+ */
+
+#include <stdio.h>
+
+enum {
+	PROF_TUNE,
+	PROF_SETTLE,
+	PROF_FLUSH,
+	PROF_FILL,		// waiting for the samples
+	PROF_ERROR,		// the line enhancer's error pass of scan()
+	PROF_FREQ_DETECT,
+	PROF_PEAK_DETECT,
+	PROF_PRESCAN,		// FFTs of the power pre-scan
+	PROF_CALLBACK,		// USB thread, in parallel with the others
+	PROF_STAGES
+};
+
+enum {
+	PROFILE_OFF,
+	PROFILE_TEXT,
+	PROFILE_JSON
+};
+
+extern int g_profile;
+
+unsigned long long profile_now();
+void profile_init(int mode);
+void profile_channel(int chan);
+void profile_add(unsigned int stage, unsigned long long ns, unsigned long long items);
+void profile_report(FILE *f);
+
+static inline unsigned long long profile_start()
+{
+	return g_profile? profile_now() : 0;
+}
+
+static inline void profile_stop(unsigned int stage, unsigned long long start, unsigned long long items = 0)
+{
+	if(g_profile)
+		profile_add(stage, profile_now() - start, items);
+}
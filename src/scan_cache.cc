@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "arfcn_freq.h"
+#include "scan_cache.h"
+
+#ifdef _WIN32
+#define mkdir(path, mode) mkdir(path)
+#endif
+
+
+/*
+ * The cache file for band bi and the device, creating the directory if need
+ * be.
+ */
+int scan_cache_path(char *path, unsigned int len, int bi, const char *device)
+{
+	const char *dir, *home;
+	unsigned int n, i;
+
+	if((dir = getenv("XDG_CACHE_HOME")) && *dir)
+		n = snprintf(path, len, "%s", dir);
+	else if((home = getenv("HOME")) && *home)
+		n = snprintf(path, len, "%s/.cache", home);
+	else
+		return -1;
+	if(n >= len)
+		return -1;
+	mkdir(path, 0755);
+	n += snprintf(path + n, len - n, "/kal");
+	if((n >= len) || (mkdir(path, 0755) && (errno != EEXIST)))
+		return -1;
+
+	i = n + strlen("/scan-");
+	n += snprintf(path + n, len - n, "/scan-%s-%s", bi_to_str(bi), device);
+	if(n >= len)
+		return -1;
+
+	// the serial comes from the device
+	for(; path[i]; i++)
+	{
+		if(!isalnum((unsigned char)path[i]) && (path[i] != '-'))
+			path[i] = '_';
+	}
+	return 0;
+}
+
+
+/*
+ * Returns the number of channels read, 0 if there is no cache, and how many
+ * seconds ago it was written.
+ */
+int scan_cache_load(const char *path, kal_channel *chans, unsigned int max, double *age)
+{
+	char line[256];
+	struct stat st;
+	unsigned int n = 0;
+	kal_channel c;
+	FILE *fp;
+
+	if(!(fp = fopen(path, "r")))
+		return 0;
+	if(age)
+		*age = fstat(fileno(fp), &st)? 0.0 : difftime(time(0), st.st_mtime);
+
+	memset(&c, 0, sizeof(c));
+	c.found = 1;
+	while(fgets(line, sizeof(line), fp) && (n < max))
+	{
+		if(line[0] == '#')
+			continue;
+		if(sscanf(line, "%d %lf %lf %f %f %d", &c.chan, &c.freq, &c.power,
+		   &c.snr, &c.offset, &c.tuner_gain) == 6)
+			chans[n++] = c;
+	}
+	fclose(fp);
+	return n;
+}
+
+
+// written to a temporary file first, so a cache is never half written
+int scan_cache_save(const char *path, const kal_channel *chans, unsigned int n)
+{
+	char tmp[1024];
+	unsigned int i;
+	FILE *fp;
+
+	if((unsigned int)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+		return -1;
+	if(!(fp = fopen(tmp, "w")))
+		return -1;
+	fprintf(fp, "# chan\tfreq\tpower\tsnr\toffset\ttuner gain\n");
+	for(i = 0; i < n; i++)
+	{
+		if(!chans[i].found)
+			continue;
+		fprintf(fp, "%d\t%.0f\t%.0f\t%.1f\t%.1f\t%d\n", chans[i].chan, chans[i].freq,
+		   chans[i].power, chans[i].snr, chans[i].offset, chans[i].tuner_gain);
+	}
+	if(fclose(fp) || rename(tmp, path))
+	{
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+
+static int by_snr(const void *a, const void *b)
+{
+	const kal_channel *x = (const kal_channel *)a, *y = (const kal_channel *)b;
+
+	if(x->snr != y->snr)
+		return (x->snr < y->snr)? 1 : -1;
+	if(x->power != y->power)
+		return (x->power < y->power)? 1 : -1;
+	return x->chan - y->chan;
+}
+
+
+// strongest first
+void scan_cache_sort(kal_channel *chans, unsigned int n)
+{
+	qsort(chans, n, sizeof(*chans), by_snr);
+}
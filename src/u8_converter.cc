@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <math.h>
+
+#include "u8_converter.h"
+
+/*
+ * The blocker is a one pole low pass on the mean byte value with a time
+ * constant of 2^14 input samples, about 10 ms at the device rate whatever
+ * the decimation.  That's a notch of a few tens of Hz, far from anything kal
+ * looks for.
+ *
+ * The estimate is updated once per call from the sum of the bytes and
+ * applied to the next call.  Updating it per sample would put a dependency
+ * between consecutive samples in the loop for no benefit at this time
+ * constant.
+ */
+#define DC_ALPHA	(1.0 / 16384)
+
+/*
+ * The float samples keep the scale of the old conversion, u * 256 - 32609,
+ * and the fixed point samples have half of it so that they fit in 14 bits.
+ */
+#define U8_SCALE	256.0f
+#define U8_ZERO		127.38f
+#define MAX16		16383
+
+
+u8_converter::u8_converter()
+{
+	unsigned int i;
+
+	for(i = 0; i < 256; i++)
+		m_lut[i] = ((float)i - U8_ZERO) * U8_SCALE;
+	reset();
+}
+
+
+void u8_converter::reset()
+{
+	m_dc_re = m_dc_im = 0.0f;
+}
+
+
+/*
+ * Fold the byte sums of a call into the DC estimate, as if each of the len
+ * bytes had gone through the low pass one at a time.
+ */
+void u8_converter::update_dc(unsigned int sum_re, unsigned int sum_im, unsigned int len)
+{
+	float k;
+
+	if(!len)
+		return;
+	k = 1.0 - pow(1.0 - DC_ALPHA, len);
+	m_dc_re += k * ((float)sum_re / len - U8_ZERO - m_dc_re);
+	m_dc_im += k * ((float)sum_im / len - U8_ZERO - m_dc_im);
+}
+
+
+/*
+ * Convert len bytes decimated by d into out, at most out_len samples.
+ * Returns the number of samples written.
+ *
+ * Without decimation each byte is a table lookup.  Otherwise the bytes are
+ * summed as integers first, which is cheaper than d lookups, and scaled with
+ * a multiplication instead of the old integer division.
+ */
+unsigned int u8_converter::convert(const unsigned char *buf, const unsigned int len, const unsigned int d, complex *out, const unsigned int out_len)
+{
+	unsigned int i, j, n, u, v, sum_re = 0, sum_im = 0;
+	float s = U8_SCALE / d, dc_re, dc_im;
+
+	n = len / (2 * d);
+	if(n > out_len)
+		n = out_len;
+	if(d == 1)
+	{
+		dc_re = m_dc_re * U8_SCALE;
+		dc_im = m_dc_im * U8_SCALE;
+		for(i = 0; i < n; i++, buf += 2)
+		{
+			sum_re += buf[0];
+			sum_im += buf[1];
+			out[i] = complex(m_lut[buf[0]] - dc_re, m_lut[buf[1]] - dc_im);
+		}
+	}
+	else
+	{
+		dc_re = (U8_ZERO + m_dc_re) * U8_SCALE;
+		dc_im = (U8_ZERO + m_dc_im) * U8_SCALE;
+		for(i = 0; i < n; i++, buf += 2 * d)
+		{
+			u = v = 0;
+			for(j = 0; j < 2 * d; j += 2)
+			{
+				u += buf[j];
+				v += buf[j + 1];
+			}
+			sum_re += u;
+			sum_im += v;
+			out[i] = complex(u * s - dc_re, v * s - dc_im);
+		}
+	}
+	update_dc(sum_re, sum_im, n * d);
+	return n;
+}
+
+
+/*
+ * The same into Q14 samples.  The average is a multiplication by 2^16 / d
+ * rather than a division.
+ */
+unsigned int u8_converter::convert16(const unsigned char *buf, const unsigned int len, const unsigned int d, complex16 *out, const unsigned int out_len)
+{
+	unsigned int i, j, n, sum_re = 0, sum_im = 0;
+	int u, v, s = ((int)U8_SCALE << 15) / (int)d, dc_re, dc_im;
+
+	dc_re = (int)lrintf((U8_ZERO + m_dc_re) * U8_SCALE / 2);
+	dc_im = (int)lrintf((U8_ZERO + m_dc_im) * U8_SCALE / 2);
+	n = len / (2 * d);
+	if(n > out_len)
+		n = out_len;
+	for(i = 0; i < n; i++, buf += 2 * d)
+	{
+		u = v = 0;
+		for(j = 0; j < 2 * d; j += 2)
+		{
+			u += buf[j];
+			v += buf[j + 1];
+		}
+		sum_re += u;
+		sum_im += v;
+		u = ((u * s) >> 16) - dc_re;
+		v = ((v * s) >> 16) - dc_im;
+		out[i].re = u < -MAX16? -MAX16 : u > MAX16? MAX16 : u;
+		out[i].im = v < -MAX16? -MAX16 : v > MAX16? MAX16 : v;
+	}
+	update_dc(sum_re, sum_im, n * d);
+	return n;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2010, Joshua Lackey
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     *  Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     *  Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * u8_converter
+ *
+ *	Turns the interleaved unsigned bytes from the dongle into decimated
+ *	complex samples in a single pass: a table lookup per byte, a box car
+ *	average over the decimation and a DC blocker.  The blocker removes the
+ *	dongle's DC spike, which the line enhancer would otherwise find as a
+ *	perfectly predictable tone and report as a low-error run.
+ *
+ *	The DC estimate is kept across calls, so feed one stream per converter.
+ */
+
+#include "usrp_complex.h"
+
+class u8_converter {
+public:
+	u8_converter();
+
+	unsigned int convert(const unsigned char *buf, const unsigned int len, const unsigned int d, complex *out, const unsigned int out_len);
+	unsigned int convert16(const unsigned char *buf, const unsigned int len, const unsigned int d, complex16 *out, const unsigned int out_len);
+	void reset();
+
+private:
+	void update_dc(unsigned int sum_re, unsigned int sum_im, unsigned int len);
+
+	float		m_lut[256];
+	float		m_dc_re,	// DC, in bytes, relative to the nominal zero
+			m_dc_im;
+};
@@ -25,7 +25,17 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#pragma once
+
 #include <complex>
 
 typedef std::complex<float> complex;
 
+/*
+ * Samples straight from the decimator for the fixed point path.
+ */
+struct complex16 {
+	short	re,
+		im;
+};
+
@@ -38,44 +38,129 @@
 #include <complex>
 
 #include "usrp_source.h"
+#include "u8_converter.h"
+#include "profile.h"
 
-static rtlsdr_dev_t	*dev;
+static rtlsdr_dev_t	*dev = 0;
+static char		dev_serial[256];
 
-#define IQ_BUFSIZE (1024000)
-static short ibuf[IQ_BUFSIZE];
-static short qbuf[IQ_BUFSIZE];
-static int iq_head = 0;
-static int iq_tail = 0;
+#define DEV_RATE (1625000)
+#define USB_BUF_LEN (48 * 512)
+#define FILL_TIMEOUT (5.0)	// seconds without samples before fill() gives up
+static unsigned int decimation = 6;
 
-static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
+/*
+ * The USB thread converts and decimates straight into the circular buffer,
+ * so it never waits for whoever consumes the samples.  If the buffer is
+ * full, the samples are dropped and counted as an overrun.
+ *
+ * usb_mutex keeps the decimation and the buffers from changing in the
+ * middle of a USB buffer.  The samples go to usb_cb16 as 16-bit integers if
+ * there is one and to usb_cb as floats otherwise, both through usb_conv.
+ */
+static pthread_mutex_t usb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int usb_overruns = 0;		// atomic, read without usb_mutex
+static typed_circular_buffer<complex> *usb_cb = 0;
+static typed_circular_buffer<complex16> *usb_cb16 = 0;
+static u8_converter usb_conv;
+
+extern int g_low_memory;
+
+/*
+ * With the low memory profile, the buffer only holds two searches' worth of
+ * samples, 12 frames and 1 burst each, so the USB thread can keep writing
+ * while one is searched.  This depends on the rate, so the buffer is
+ * replaced when the decimation changes.
+ */
+static unsigned int buffer_len(unsigned int d, unsigned int cb_len)
 {
-	//decimation = 6
-	for(unsigned int i=0; i<len; i+=12)
+	if(!g_low_memory)
+		return cb_len;
+	return 2 * (unsigned int)ceil((12 * 8 * 156.25 + 156.25) * 6.0 / d);
+}
+
+static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *)
+{
+	typed_circular_buffer<complex>::view w;
+	typed_circular_buffer<complex16>::view w16;
+	unsigned long long t = profile_start();
+	unsigned int n;
+
+	pthread_mutex_lock(&usb_mutex);
+	if(usb_cb16)
 	{
-		int j;
-		int u = 0;
-		for(j=0; j<12; j+=2)
-			u += buf[i+j];
-		ibuf[iq_head] = u*128/3-32609;
-		u = 0;
-		for(j=1; j<12; j+=2)
-			u += buf[i+j];
-		qbuf[iq_head] = u*128/3-32609;
-		iq_head++;
-		if(iq_head == IQ_BUFSIZE)
-			iq_head = 0;
-		if(iq_head == iq_tail)
-		{
-			printf("Buffer full\n");
-			break;
-	 	}
+		w16 = usb_cb16->writable();
+		n = usb_conv.convert16(buf, len, decimation, w16.data, w16.len);
+		usb_cb16->commit(n);
+	}
+	else
+	{
+		w = usb_cb->writable();
+		n = usb_conv.convert(buf, len, decimation, w.data, w.len);
+		usb_cb->commit(n);
 	}
-	//printf("len=%d\n",len);
+	if(n < len / (2 * decimation))
+		__atomic_fetch_add(&usb_overruns, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&usb_mutex);
+	profile_stop(PROF_CALLBACK, t, len);
 }
 
+/*
+ * The thread reading the device, from open() until the destructor cancels
+ * the read and joins it.
+ */
+static pthread_t dongle_thread;
+static int dongle_running = 0;
+
 static void *dongle_thread_fn(void *arg)
 {
-	rtlsdr_read_async(dev, rtlsdr_callback, NULL, 0, 48*512);
+	rtlsdr_read_async(dev, rtlsdr_callback, arg, 0, USB_BUF_LEN);
+	return NULL;
+}
+
+
+/*
+ * Instead of a device, samples can come from an rtl_sdr file recorded at
+ * DEV_RATE.  The file goes through the same callback as the USB buffers,
+ * but only as fast as the buffer empties, so nothing is ever dropped and
+ * the same file always gives the same result.  At the end, it starts over.
+ */
+static FILE *in_fp = 0;
+static pthread_t file_thread;
+static volatile int file_stop = 0;
+
+static unsigned int file_space()
+{
+	unsigned int r;
+
+	pthread_mutex_lock(&usb_mutex);
+	r = usb_cb16? usb_cb16->space_available() : usb_cb->space_available();
+	r = r >= USB_BUF_LEN / (2 * decimation);
+	pthread_mutex_unlock(&usb_mutex);
+	return r;
+}
+
+
+static void *file_thread_fn(void *)
+{
+	unsigned char *buf = new unsigned char[USB_BUF_LEN];
+	size_t n;
+
+	while(!file_stop)
+	{
+		if(!file_space())
+		{
+			usleep(1000);
+			continue;
+		}
+		if((n = fread(buf, 1, USB_BUF_LEN, in_fp) & ~1) < 2)
+		{
+			rewind(in_fp);
+			continue;
+		}
+		rtlsdr_callback(buf, n, 0);
+	}
+	delete[] buf;
 	return NULL;
 }
 
@@ -83,8 +168,11 @@ usrp_source::usrp_source(void)
 {
 	m_center_freq = 0.0;
 	m_sample_rate = 0.0;
-	m_cb = new circular_buffer(CB_LEN, sizeof(complex), 0);
+	m_cb = new typed_circular_buffer<complex>(buffer_len(decimation, CB_LEN), 0, 1);
+	m_cb16 = 0;
 	m_freq_corr = 0;
+	m_bandwidth = 0;
+	m_overruns = 0;
 
 	pthread_mutex_init(&m_u_mutex, 0);
 }
@@ -93,9 +181,32 @@ usrp_source::usrp_source(void)
 usrp_source::~usrp_source()
 {
 	stop();
+	if(in_fp)
+	{
+		file_stop = 1;
+		pthread_join(file_thread, 0);
+		fclose(in_fp);
+		in_fp = 0;
+	}
+	else if(dev)
+	{
+		rtlsdr_cancel_async(dev);
+		if(dongle_running)
+		{
+			pthread_join(dongle_thread, 0);
+			dongle_running = 0;
+		}
+		rtlsdr_close(dev);
+		dev = 0;
+	}
+
+	// the next session mustn't see this one's buffers
+	pthread_mutex_lock(&usb_mutex);
+	usb_cb = 0;
+	usb_cb16 = 0;
+	pthread_mutex_unlock(&usb_mutex);
 	delete m_cb;
-	rtlsdr_cancel_async(dev);
-	rtlsdr_close(dev);
+	delete m_cb16;
 	pthread_mutex_destroy(&m_u_mutex);
 }
 
@@ -114,18 +225,82 @@ void usrp_source::start()
 }
 
 
+/*
+ * Names the device across runs: its serial number, its index if it has none,
+ * or "file".
+ */
+const char *usrp_source::serial()
+{
+	return dev_serial;
+}
+
+
 float usrp_source::sample_rate()
 {
 	return m_sample_rate;
 }
 
 
+/*
+ * The device always runs at DEV_RATE.  By default, it is decimated by 6 to
+ * the GSM symbol rate but a decimation of 1 gives the full bandwidth, e.g.,
+ * to look at several channels at once.
+ *
+ * This may replace the buffer, so call get_buffer() again afterwards.
+ */
+void usrp_source::set_decimation(unsigned int d)
+{
+	if(!d)
+		d = 1;
+
+	pthread_mutex_lock(&usb_mutex);
+	if(buffer_len(d, CB_LEN) != buffer_len(decimation, CB_LEN))
+	{
+		delete m_cb;
+		m_cb = new typed_circular_buffer<complex>(buffer_len(d, CB_LEN), 0, 1);
+		if(m_cb16)
+		{
+			delete m_cb16;
+			m_cb16 = new typed_circular_buffer<complex16>(buffer_len(d, CB_LEN), 0, 1);
+		}
+	}
+	decimation = d;
+	m_sample_rate = (float)DEV_RATE / d;
+	usb_cb = m_cb;
+	usb_cb16 = m_cb16;
+	drop();
+	pthread_mutex_unlock(&usb_mutex);
+}
+
+
+/*
+ * Deliver 16-bit integer samples through get_buffer16() instead of floats,
+ * for fcch_detector_fixed.
+ */
+void usrp_source::set_fixed_point(int on)
+{
+	pthread_mutex_lock(&usb_mutex);
+	if(on && !m_cb16)
+		m_cb16 = new typed_circular_buffer<complex16>(buffer_len(decimation, CB_LEN), 0, 1);
+	else if(!on && m_cb16)
+	{
+		delete m_cb16;
+		m_cb16 = 0;
+	}
+	usb_cb16 = m_cb16;
+	pthread_mutex_unlock(&usb_mutex);
+}
+
+
 int usrp_source::tune(double freq)
 {
+	unsigned long long t = profile_start();
 	int r = 0;
 
 	pthread_mutex_lock(&m_u_mutex);
-	if (freq != m_center_freq)
+	if(in_fp)
+		m_center_freq = freq;
+	else if (freq != m_center_freq)
 	{
 		r = rtlsdr_set_center_freq(dev, (uint32_t)freq);
 		if (r < 0)
@@ -134,6 +309,7 @@ int usrp_source::tune(double freq)
 			m_center_freq = rtlsdr_get_center_freq(dev);
 	}
 	pthread_mutex_unlock(&m_u_mutex);
+	profile_stop(PROF_TUNE, t);
 
 	return (r < 0) ? 0 : 1;
 }
@@ -142,6 +318,8 @@ int usrp_source::tune(double freq)
 int usrp_source::set_freq_correction(int ppm)
 {
 	m_freq_corr = ppm;
+	if(in_fp)
+		return 0;
 	return rtlsdr_set_freq_correction(dev, ppm);
 }
 
@@ -151,6 +329,9 @@ int usrp_source::set_bandwidth(int bandwidth)
 	int r;
 	uint32_t applied_bw = 0;
 
+	m_bandwidth = bandwidth;
+	if(in_fp)
+		return 0;
 	r = rtlsdr_set_and_get_tuner_bandwidth(dev, bandwidth, &applied_bw, 1 /* =apply_bw */);
 	if (r < 0)
 		fprintf(stderr, "WARNING: Failed to set bandwidth.\n");
@@ -167,9 +348,18 @@ int usrp_source::set_bandwidth(int bandwidth)
 }
 
 
+// the last one asked for, 0 for automatic
+int usrp_source::bandwidth()
+{
+	return m_bandwidth;
+}
+
+
 bool usrp_source::set_dithering(bool enable)
 {
 #if HAVE_DITHERING == 1
+	if(in_fp)
+		return true;
 	return (bool)(!rtlsdr_set_dithering(dev, (int)enable));
 #else
 	return true;
@@ -181,6 +371,8 @@ bool usrp_source::set_gain(int gain)
 {
 	int r;
 
+	if(in_fp)
+		return 1;
 	if (gain == 0)
 	{
 		r = rtlsdr_set_agc_mode(dev, 1);
@@ -210,6 +402,8 @@ int usrp_source::get_tuner_gain(void)
 	int tuner_gain = 0;
 
 #if HAVE_GET_TUNER_GAIN == 1
+	if(in_fp)
+		return 0;
 	rtlsdr_get_tuner_i2c_register(dev, reg_values, &len, &tuner_gain);
 	tuner_gain = (tuner_gain + 5) / 10;
 #endif
@@ -223,15 +417,14 @@ int usrp_source::get_tuner_gain(void)
 int usrp_source::open(unsigned int dev_index)
 {
 	int i, r, device_count;
-	pthread_t dongle_thread;
 
-	m_sample_rate = 1625000.0 / 6.0; //decimation = 6
+	m_sample_rate = (float)DEV_RATE / decimation;
 
 	device_count = rtlsdr_get_device_count();
 	if (!device_count)
 	{
 		printf("No supported devices found.\n");
-		exit(1);
+		return -1;
 	}
 	printf("Found %d device(s):\n", device_count);
 	for (i = 0; i < device_count; i++)
@@ -242,15 +435,20 @@ int usrp_source::open(unsigned int dev_index)
 		dev_index,
 		rtlsdr_get_device_name(dev_index));
 
+	// the index depends on what else is plugged in, the serial doesn't
+	if(rtlsdr_get_device_usb_strings(dev_index, 0, 0, dev_serial) || !dev_serial[0])
+		snprintf(dev_serial, sizeof(dev_serial), "%u", dev_index);
+
 	r = rtlsdr_open(&dev, dev_index);
 	if (r < 0)
 	{
 		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
-		exit(1);
+		dev = 0;
+		return -1;
 	}
 
 	/* Set the sample rate */
-	r = rtlsdr_set_sample_rate(dev, 1625000);
+	r = rtlsdr_set_sample_rate(dev, DEV_RATE);
 	if (r < 0)
 		fprintf(stderr, "WARNING: Failed to set sample rate.\n");
 
@@ -259,57 +457,96 @@ int usrp_source::open(unsigned int dev_index)
 	if (r < 0)
 		fprintf(stderr, "WARNING: Failed to reset buffers.\n");
 
-	pthread_create(&dongle_thread, NULL, dongle_thread_fn, NULL);
+	pthread_mutex_lock(&usb_mutex);
+	usb_cb = m_cb;
+	usb_cb16 = m_cb16;
+	pthread_mutex_unlock(&usb_mutex);
+
+	if(pthread_create(&dongle_thread, NULL, dongle_thread_fn, 0))
+	{
+		fprintf(stderr, "error: pthread_create\n");
+		rtlsdr_close(dev);
+		dev = 0;
+		return -1;
+	}
+	dongle_running = 1;
 	return 0;
 }
 
 
-int usrp_source::fill(unsigned int num_samples, unsigned int *overrun_i)
+/*
+ * Like open() but read the samples from an rtl_sdr file.
+ */
+int usrp_source::open_file(const char *name)
 {
-	complex *c;
-	unsigned int i, j = 0, space = 0, overruns = 0;
-
-	while((m_cb->data_available() < num_samples) && (m_cb->space_available() > 0))
+	if(!(in_fp = fopen(name, "rb")))
 	{
-		j++;
-		// read one usb packet from the usrp
-		pthread_mutex_lock(&m_u_mutex);
-		i = 0;
-		while(((iq_head-iq_tail >= 0) && (iq_head-iq_tail < (int)num_samples)) ||
-		      ((iq_head-iq_tail < 0) && (IQ_BUFSIZE+iq_head-iq_tail < (int)num_samples) ))
-		{
-			i++;
-			usleep(1000);
-		}
-		//printf("num_samples=%d, i=%d\n", num_samples, i);
+		perror(name);
+		return -1;
+	}
+	if(fseek(in_fp, 0, SEEK_END) || (ftell(in_fp) < 2))
+	{
+		fprintf(stderr, "error: %s has no samples\n", name);
+		fclose(in_fp);
+		in_fp = 0;
+		return -1;
+	}
+	rewind(in_fp);
+	snprintf(dev_serial, sizeof(dev_serial), "file");
+	printf("Reading samples from %s\n", name);
 
-		// write complex<short> input to complex<float> output
-		c = (complex *)m_cb->poke(&space);
+	m_sample_rate = (float)DEV_RATE / decimation;
 
-		// set space to number of complex items to copy
-		space = num_samples;
+	pthread_mutex_lock(&usb_mutex);
+	usb_cb = m_cb;
+	usb_cb16 = m_cb16;
+	pthread_mutex_unlock(&usb_mutex);
 
-		// write data
-		for(i = 0; i<space; i++)
-		{
-			c[i] = complex(ibuf[iq_tail], qbuf[iq_tail]);
-			iq_tail++;
-			if(iq_tail == IQ_BUFSIZE)
-				iq_tail = 0;
-			//printf("%d/%d ", ibuf[i], qbuf[i]);
-		}
-		pthread_mutex_unlock(&m_u_mutex);
-		// update cb
-		m_cb->wrote(i);
+	file_stop = 0;
+	if(pthread_create(&file_thread, NULL, file_thread_fn, 0))
+	{
+		fclose(in_fp);
+		in_fp = 0;
+		return -1;
 	}
+	return 0;
+}
+
 
-	// if the cb is full, we left behind data from the usb packet
-	if(m_cb->space_available() == 0)
+/*
+ * Wait until at least num_samples are available in the buffer.  overrun_i
+ * is set to the number of times samples were dropped since the last call.
+ */
+int usrp_source::fill(unsigned int num_samples, unsigned int *overrun_i)
+{
+	unsigned long long t = profile_start();
+	int r;
+
+	r = wait_samples(num_samples, overrun_i);
+	profile_stop(PROF_FILL, t, num_samples);
+	return r;
+}
+
+
+int usrp_source::wait_samples(unsigned int num_samples, unsigned int *overrun_i)
+{
+	unsigned int overruns;
+
+	if(num_samples > (m_cb16? m_cb16->buf_len() : m_cb->buf_len()))
+		return -1;
+
+	if(m_cb16? m_cb16->wait_for_data(num_samples, FILL_TIMEOUT) :
+	   m_cb->wait_for_data(num_samples, FILL_TIMEOUT))
 	{
-		fprintf(stderr, "warning: local overrun\n");
-		overruns++;
+		fprintf(stderr, "error: no samples from the device\n");
+		return -1;
 	}
 
+	overruns = __atomic_load_n(&usb_overruns, __ATOMIC_RELAXED) - m_overruns;
+	m_overruns += overruns;
+	if(overruns)
+		fprintf(stderr, "warning: local overrun\n");
+
 	if(overrun_i)
 		*overrun_i = overruns;
 
@@ -320,23 +557,49 @@ int usrp_source::fill(unsigned int num_samples, unsigned int *overrun_i)
 /*
  * Don't hold a lock on this and use the usrp at the same time.
  */
-circular_buffer *usrp_source::get_buffer()
+typed_circular_buffer<complex> *usrp_source::get_buffer()
 {
 	return m_cb;
 }
 
+
+typed_circular_buffer<complex16> *usrp_source::get_buffer16()
+{
+	return m_cb16;
+}
+
+
+/*
+ * Throw away whatever is in the buffer in use.
+ */
+void usrp_source::drop()
+{
+	if(m_cb16)
+		m_cb16->consume(m_cb16->data_available());
+	else
+		m_cb->consume(m_cb->data_available());
+}
+
 #define FLUSH_SIZE		512
 
+/*
+ * Throw away everything received so far and the next flush_count packets,
+ * e.g., while the tuner settles.
+ */
 int usrp_source::flush(unsigned int flush_count)
 {
-	m_cb->flush();
-	fill(flush_count * FLUSH_SIZE, 0);
-	m_cb->flush();
+	unsigned long long t = profile_start();
 
-	pthread_mutex_lock(&m_u_mutex);
-	iq_head = 0;
-	iq_tail = 0;
-	pthread_mutex_unlock(&m_u_mutex);
+	drop();
+	if(flush_count)
+	{
+		wait_samples(flush_count * FLUSH_SIZE, 0);
+		drop();
+	}
+
+	// overruns before this don't matter anymore
+	m_overruns = __atomic_load_n(&usb_overruns, __ATOMIC_RELAXED);
+	profile_stop(PROF_FLUSH, t);
 
 	return 0;
 }
@@ -37,25 +37,37 @@ public:
 	~usrp_source();
 
 	int open(unsigned int device);
+	int open_file(const char *name);
 	int fill(unsigned int num_samples, unsigned int *overrun);
 	int tune(double freq);
 	int set_freq_correction(int ppm);
 	bool set_gain(int gain);
 	bool set_dithering(bool enable);
 	int set_bandwidth(int bandwidth);
+	int bandwidth();
 	int get_tuner_gain(void);
 	void start();
 	void stop();
 	int flush(unsigned int flush_count = FLUSH_COUNT);
-	circular_buffer *get_buffer();
+	typed_circular_buffer<complex> *get_buffer();
+	typed_circular_buffer<complex16> *get_buffer16();
 	float sample_rate();
+	const char *serial();
+	void set_decimation(unsigned int d);
+	void set_fixed_point(int on);
 
 	double			m_center_freq;
 	int			m_freq_corr;
 
 private:
 	float			m_sample_rate;
-	circular_buffer 	*m_cb;
+	int			m_bandwidth;
+	void drop();
+	int wait_samples(unsigned int num_samples, unsigned int *overrun);
+
+	typed_circular_buffer<complex>	*m_cb;
+	typed_circular_buffer<complex16>	*m_cb16;
+	unsigned int		m_overruns;
 
 	/*
 	 * This mutex protects access to the USRP and daughterboards but not
@@ -64,5 +76,5 @@ private:
 	pthread_mutex_t		m_u_mutex;
 
 	static const unsigned int	FLUSH_COUNT	= 10;
-	static const unsigned int	CB_LEN		= (16 * 16384);
+	static const unsigned int	CB_LEN		= (32 * 16384);
 };
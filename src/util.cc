@@ -30,6 +30,8 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include "util.h"
+
 
 void display_freq(float f)
 {
@@ -71,20 +73,17 @@ void display_freq(float f)
 }
 
 
-void sort(float *b, unsigned int len)
+/*
+ * Insert v into the sorted array b of len items.  b must have room for one
+ * more item.
+ */
+void sorted_insert(float *b, unsigned int len, float v)
 {
-	for(unsigned int i = 0; i < len; i++)
-	{
-		for(unsigned int j = i + 1; j < len; j++)
-		{
-			if(b[j] < b[i])
-			{
-				float t = b[i];
-				b[i] = b[j];
-				b[j] = t;
-			}
-		}
-	}
+	unsigned int i;
+
+	for(i = len; (i > 0) && (b[i - 1] > v); i--)
+		b[i] = b[i - 1];
+	b[i] = v;
 }
 
 
@@ -107,3 +106,16 @@ double avg(float *b, unsigned int len, float *stddev)
 
 	return a;
 }
+
+
+// the energy of v
+double vectornorm2(const complex *v, const unsigned int len)
+{
+	unsigned int i;
+	double e = 0.0;
+
+	for(i = 0; i < len; i++)
+		e += norm(v[i]);
+
+	return e;
+}
@@ -25,6 +25,9 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "usrp_complex.h"
+
 void display_freq(float f);
-void sort(float *b, unsigned int len);
+void sorted_insert(float *b, unsigned int len, float v);
 double avg(float *b, unsigned int len, float *stddev);
+double vectornorm2(const complex *v, const unsigned int len);